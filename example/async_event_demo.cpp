@@ -0,0 +1,145 @@
+// A bounded buffer on coz::async_mutex and coz::async_condition_variable,
+// whose producers are started by a coz::async_event, and a ping-pong on two
+// coz::async_auto_reset_event. Counts the allocations after the setup.
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <coz/async_event.hpp>
+#include <coz/async_condition_variable.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::size_t g_allocs = 0;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 160>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    struct buffer {
+        static constexpr int capacity = 4;
+
+        coz::async_mutex m_mutex;
+        coz::async_condition_variable m_not_full;
+        coz::async_condition_variable m_not_empty;
+        int m_items[capacity];
+        int m_head = 0;
+        int m_size = 0;
+        int m_producers = 0;
+    };
+} // namespace demo
+
+void* operator new(std::size_t size) {
+    ++demo::g_allocs;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto producer(demo::buffer& buf, coz::async_event& go, int n)
+    COZ_BEG(demo::job_init, (buf, go, n), int i = 0;) {
+    COZ_AWAIT(go.wait());
+    for (; i != n; ++i) {
+        COZ_AWAIT(buf.m_mutex.lock());
+        while (buf.m_size == buf.capacity)
+            COZ_AWAIT(buf.m_not_full.wait(buf.m_mutex));
+        buf.m_items[(buf.m_head + buf.m_size++) % buf.capacity] = i;
+        buf.m_mutex.unlock();
+        buf.m_not_empty.notify_one();
+    }
+    COZ_AWAIT(buf.m_mutex.lock());
+    --buf.m_producers;
+    buf.m_mutex.unlock();
+    buf.m_not_empty.notify_all();
+}
+COZ_END
+
+auto consumer(demo::buffer& buf, long& sum)
+    COZ_BEG(demo::job_init, (buf, sum), coz::async_mutex_lock lock;) {
+    COZ_AWAIT_SET(lock, buf.m_mutex.scoped_lock());
+    for (;;) {
+        while (buf.m_size == 0 && buf.m_producers != 0)
+            COZ_AWAIT(buf.m_not_empty.wait(lock));
+        if (buf.m_size == 0)
+            break;
+        sum += buf.m_items[buf.m_head];
+        buf.m_head = (buf.m_head + 1) % buf.capacity;
+        --buf.m_size;
+        buf.m_not_full.notify_one();
+    }
+}
+COZ_END
+
+auto pinger(coz::async_auto_reset_event& in, coz::async_auto_reset_event& out,
+            int n, int& count)
+    COZ_BEG(demo::job_init, (in, out, n, count), int i = 0;) {
+    for (; i != n; ++i) {
+        COZ_AWAIT(in.wait());
+        ++count;
+        out.set();
+    }
+}
+COZ_END
+
+int main() {
+    constexpr int producers = 3;
+    constexpr int consumers = 2;
+    constexpr int items = 10000;
+    demo::buffer buf;
+    buf.m_producers = producers;
+    coz::async_event go;
+    long sums[consumers] = {};
+    demo::job jobs[producers + consumers];
+    for (int i = 0; i != producers; ++i)
+        jobs[i] = producer(buf, go, items);
+    for (int i = 0; i != consumers; ++i)
+        jobs[producers + i] = consumer(buf, sums[i]);
+
+    std::size_t allocs = demo::g_allocs;
+    for (auto& job : jobs)
+        job.start();
+    go.set();
+    long sum = 0;
+    for (const long s : sums)
+        sum += s;
+    std::cout << "buffer: sum " << sum << " (expected "
+              << long(producers) * items * (items - 1) / 2 << "), "
+              << demo::g_allocs - allocs << " allocations\n";
+
+    coz::async_auto_reset_event ping, pong;
+    int pings = 0, pongs = 0;
+    demo::job a = pinger(ping, pong, items, pings);
+    demo::job b = pinger(pong, ping, items, pongs);
+    allocs = demo::g_allocs;
+    a.start();
+    b.start();
+    ping.set();
+    std::cout << "ping-pong: " << pings << " pings, " << pongs << " pongs, "
+              << demo::g_allocs - allocs << " allocations\n";
+}
@@ -0,0 +1,97 @@
+#include <deque>
+#include <iostream>
+#include <vector>
+#include <coz/async_generator.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    // Suspended coroutines, resumed by the loop in 'main' to simulate I/O.
+    std::deque<coz::coroutine_handle<>> g_ready;
+
+    // Fetch a page of a paginated scan, the last page is empty.
+    struct fetch_page {
+        int m_page;
+        int m_count;
+
+        bool await_ready() const noexcept { return false; }
+
+        void await_suspend(coz::coroutine_handle<> coro) {
+            g_ready.push_back(coro);
+        }
+
+        std::vector<int> await_resume() const {
+            std::cout << "[page " << m_page << "] ";
+            std::vector<int> items;
+            if (m_page != m_count) {
+                for (int i = 0; i != 3; ++i)
+                    items.push_back(m_page * 10 + i);
+            }
+            return items;
+        }
+    };
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 512>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+// Only one page is held at a time.
+auto scan(int pages) COZ_BEG(coz::async_generator<int>, (pages), int page = 0;
+                             std::vector<int> items; std::size_t i;) {
+    for (;; ++page) {
+        COZ_AWAIT_SET(items, (demo::fetch_page{page, pages}));
+        if (items.empty())
+            break;
+        for (i = 0; i != items.size(); ++i)
+            COZ_YIELD(items[i]);
+    }
+}
+COZ_END
+
+auto consume(const char* name, int pages, int limit)
+    COZ_BEG(demo::job_init, (name, pages, limit), int sum = 0;) {
+    COZ_FOR_AWAIT(int v, scan(pages)) {
+        if (v > limit)
+            break;
+        std::cout << name << v << ' ';
+        sum += v;
+    }
+    std::cout << '\n' << name << " sum: " << sum << '\n';
+}
+COZ_END
+
+int main() {
+    demo::job a = consume("a", 3, 100);
+    demo::job b = consume("b", 3, 11);
+    a.start();
+    b.start();
+    while (!demo::g_ready.empty()) {
+        auto coro = demo::g_ready.front();
+        demo::g_ready.pop_front();
+        coro.resume();
+    }
+    std::cout << "done: " << a.done() << b.done() << '\n';
+}
@@ -0,0 +1,151 @@
+// Contended lock/unlock on coz::thread_pool: std::mutex blocks the worker,
+// while coz::async_mutex and coz::async_shared_mutex suspend the coroutine
+// and hand the lock to the next waiter.
+#include <mutex>
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <coz/async_mutex.hpp>
+#include <coz/thread_pool.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::atomic<int> g_remaining;
+    unsigned long g_counter;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {
+            if (g_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                g_remaining.notify_all();
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 128>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    // The work in the critical section.
+    void touch(int work) {
+        unsigned long x = g_counter;
+        for (int i = 0; i != work; ++i)
+            x = x * 6364136223846793005ul + 1442695040888963407ul;
+        g_counter = x + 1;
+    }
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+// Yield every 16 iterations, so that the jobs interleave across the workers.
+auto std_worker(coz::thread_pool& pool, std::mutex& m, int iters, int work)
+    COZ_BEG(demo::job_init, (pool, m, iters, work), int i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != iters; ++i) {
+        {
+            std::lock_guard lock(m);
+            demo::touch(work);
+        }
+        if (i % 16 == 15)
+            COZ_AWAIT(pool.schedule());
+    }
+}
+COZ_END
+
+auto async_worker(coz::thread_pool& pool, coz::async_mutex& m, int iters,
+                  int work)
+    COZ_BEG(demo::job_init, (pool, m, iters, work), int i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != iters; ++i) {
+        COZ_AWAIT(m.lock());
+        demo::touch(work);
+        m.unlock();
+        if (i % 16 == 15)
+            COZ_AWAIT(pool.schedule());
+    }
+}
+COZ_END
+
+auto shared_worker(coz::thread_pool& pool, coz::async_shared_mutex& m,
+                   int iters, int work)
+    COZ_BEG(demo::job_init, (pool, m, iters, work), int i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != iters; ++i) {
+        COZ_AWAIT(m.lock());
+        demo::touch(work);
+        m.unlock();
+        if (i % 16 == 15)
+            COZ_AWAIT(pool.schedule());
+    }
+}
+COZ_END
+
+// Returns the elapsed time in ns.
+template<class Mutex, class Worker>
+double bench(Worker worker, unsigned threads, int jobs, int iters, int work) {
+    std::vector<demo::job> v;
+    v.reserve(jobs);
+    Mutex m;
+    // Destroyed before the jobs, so no worker is still returning from them.
+    coz::thread_pool pool(threads);
+    for (int i = 0; i != jobs; ++i)
+        v.push_back(worker(pool, m, iters, work));
+    demo::g_counter = 0;
+    demo::g_remaining.store(jobs);
+    const auto beg = std::chrono::steady_clock::now();
+    for (auto& job : v)
+        job.start();
+    for (int n; (n = demo::g_remaining.load()) != 0;)
+        demo::g_remaining.wait(n);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    if (work == 0 && demo::g_counter != (unsigned long)jobs * iters)
+        std::cout << "  wrong count: " << demo::g_counter << '\n';
+    return elapsed.count();
+}
+
+int main(int argc, char**) {
+    const unsigned max_threads = std::thread::hardware_concurrency();
+    const int jobs = 256 + argc - 1;
+    const int iters = 4000;
+    std::cout << "hardware threads: " << max_threads << '\n';
+    for (const int work : {0, 50}) {
+        std::cout << "work " << work << ":\n";
+        for (unsigned threads = 1;; threads *= 2) {
+            if (threads > max_threads)
+                threads = max_threads;
+            const double ops = double(jobs) * iters;
+            std::cout << "  " << threads << " threads: std::mutex "
+                      << bench<std::mutex>(std_worker, threads, jobs, iters,
+                                           work) /
+                             ops
+                      << " ns, async_mutex "
+                      << bench<coz::async_mutex>(async_worker, threads, jobs,
+                                                 iters, work) /
+                             ops
+                      << " ns, async_shared_mutex "
+                      << bench<coz::async_shared_mutex>(shared_worker, threads,
+                                                        jobs, iters, work) /
+                             ops
+                      << " ns per lock\n";
+            if (threads == max_threads)
+                break;
+        }
+    }
+}
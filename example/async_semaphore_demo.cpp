@@ -0,0 +1,137 @@
+// coz::async_semaphore bounds the jobs in flight on coz::thread_pool,
+// coz::async_latch waits for all of them, and coz::async_barrier keeps a
+// group of jobs in lockstep. The waiters are released to the pool in
+// batches.
+#include <atomic>
+#include <vector>
+#include <iostream>
+#include <coz/thread_pool.hpp>
+#include <coz/inplace_task.hpp>
+#include <coz/async_latch.hpp>
+#include <coz/async_barrier.hpp>
+#include <coz/async_semaphore.hpp>
+
+namespace demo {
+    std::atomic<int> g_remaining;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {
+            if (g_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                g_remaining.notify_all();
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 160>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    std::atomic<int> g_in_flight;
+    std::atomic<int> g_max_in_flight;
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto request(coz::thread_pool& pool, coz::async_semaphore& sem,
+             coz::async_latch& done)
+    COZ_BEG(demo::job_init, (pool, sem, done), int i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    COZ_AWAIT(sem.acquire());
+    {
+        const int n = demo::g_in_flight.fetch_add(1) + 1;
+        int max = demo::g_max_in_flight.load();
+        while (n > max && !demo::g_max_in_flight.compare_exchange_weak(max, n))
+            ;
+    }
+    // Pretend to wait for I/O.
+    for (; i != 4; ++i)
+        COZ_AWAIT(pool.schedule());
+    demo::g_in_flight.fetch_sub(1);
+    sem.release(pool);
+    done.count_down(pool);
+}
+COZ_END
+
+auto collect(coz::async_latch& done, int& result)
+    COZ_BEG(demo::job_init, (done, result)) {
+    COZ_AWAIT(done.wait());
+    result = demo::g_max_in_flight.load();
+}
+COZ_END
+
+auto step(coz::thread_pool& pool, coz::async_barrier& barrier,
+          std::atomic<int>* arrived, int phases,
+          std::atomic<bool>& ok)
+    COZ_BEG(demo::job_init, (pool, barrier, arrived, phases, ok), int i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != phases; ++i) {
+        arrived[i].fetch_add(1);
+        COZ_AWAIT(barrier.arrive_and_wait(pool));
+        // Everyone has arrived at this phase.
+        if (arrived[i].load() != int(pool.size()) * 2)
+            ok = false;
+    }
+}
+COZ_END
+
+void wait_all() {
+    for (int n; (n = demo::g_remaining.load()) != 0;)
+        demo::g_remaining.wait(n);
+}
+
+int main() {
+    constexpr int requests = 1000;
+    constexpr int limit = 8;
+    coz::async_semaphore sem(limit);
+    coz::async_latch done(requests);
+    int max_in_flight = 0;
+    {
+        std::vector<demo::job> v;
+        v.reserve(requests + 1);
+        coz::thread_pool pool(4);
+        for (int i = 0; i != requests; ++i)
+            v.push_back(request(pool, sem, done));
+        v.push_back(collect(done, max_in_flight));
+        demo::g_remaining.store(requests + 1);
+        for (auto& job : v)
+            job.start();
+        wait_all();
+    }
+    std::cout << "max in flight: " << max_in_flight << " (limit " << limit
+              << ")\n";
+
+    constexpr int phases = 100;
+    std::atomic<int> arrived[phases] = {};
+    std::atomic<bool> ok = true;
+    {
+        std::vector<demo::job> v;
+        coz::thread_pool pool(4);
+        const int group = int(pool.size()) * 2;
+        coz::async_barrier barrier(group);
+        v.reserve(group);
+        for (int i = 0; i != group; ++i)
+            v.push_back(step(pool, barrier, arrived, phases, ok));
+        demo::g_remaining.store(group);
+        for (auto& job : v)
+            job.start();
+        wait_all();
+    }
+    std::cout << "barrier " << phases << " phases: " << (ok ? "ok" : "wrong")
+              << '\n';
+}
@@ -0,0 +1,124 @@
+#include <algorithm>
+#include <iostream>
+#include <optional>
+#include <vector>
+#include <coz/cancellation.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    struct read_op;
+
+    // Pending reads, completed by 'poll'.
+    std::vector<read_op*> g_pending;
+
+    struct read_op {
+        struct on_stop {
+            read_op* m_op;
+
+            // 'disarm' destroys this callback, so it's done first.
+            void operator()() const noexcept {
+                read_op* op = m_op;
+                op->m_stop.disarm();
+                op->complete(std::nullopt);
+            }
+        };
+
+        bool await_ready() const noexcept { return false; }
+
+        template<class Promise>
+        bool await_suspend(coz::coroutine_handle<Promise> coro) {
+            m_coro = coro;
+            if (!m_stop.arm(coro, on_stop{this}))
+                return false;
+            g_pending.push_back(this);
+            return true;
+        }
+
+        std::optional<int> await_resume() const noexcept { return m_result; }
+
+        // The coroutine is destroyed while the read is pending.
+        void await_cancel() noexcept {
+            std::cout << "(read cancelled) ";
+            m_stop.disarm();
+            std::erase(g_pending, this);
+        }
+
+        void complete(std::optional<int> result) {
+            std::erase(g_pending, this);
+            m_result = result;
+            m_coro.resume();
+        }
+
+        coz::coroutine_handle<> m_coro;
+        coz::stop_slot<on_stop> m_stop;
+        std::optional<int> m_result;
+    };
+
+    void poll(int value) {
+        for (auto op : std::vector(g_pending)) {
+            op->m_stop.disarm();
+            op->complete(value);
+        }
+    }
+
+    struct job_promise : coz::stoppable_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 256>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto reader(const char* name) COZ_BEG(demo::job_init, (name)) {
+    for (;;) {
+        COZ_AWAIT_LET(std::optional<int> v, demo::read_op{}) {
+            if (!v) {
+                std::cout << name << " stopped\n";
+                COZ_RETURN();
+            }
+            std::cout << name << " read " << *v << '\n';
+        }
+    }
+}
+COZ_END
+
+int main() {
+    demo::job a = reader("a");
+    demo::job b = reader("b");
+    a.start();
+    b.start();
+    demo::poll(1);
+    // Cooperative: 'a' observes the stop and returns.
+    a.promise().request_stop();
+    demo::poll(2);
+    // Forced: the pending read of 'b' is withdrawn.
+    b.reset();
+    std::cout << "\npending: " << demo::g_pending.size() << '\n';
+    // A destroyed coroutine is done, so its owner doesn't destroy it again.
+    demo::job c = reader("c");
+    c.start();
+    c.destroy();
+    std::cout << "\ndone after destroy: " << std::boolalpha << c.done()
+              << '\n';
+    return c.done() ? 0 : 1;
+}
@@ -0,0 +1,105 @@
+// Throughput of coz::channel on coz::thread_pool, with 1, 2, 8 and 32
+// producers and as many consumers.
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <coz/channel.hpp>
+#include <coz/thread_pool.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::atomic<int> g_remaining;
+    std::atomic<long> g_sum;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {
+            if (g_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                g_remaining.notify_all();
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 128>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    using channel = coz::channel<long, 256>;
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto producer(coz::thread_pool& pool, demo::channel& chan, long n)
+    COZ_BEG(demo::job_init, (pool, chan, n), long i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != n; ++i)
+        COZ_AWAIT(chan.send(i));
+}
+COZ_END
+
+auto consumer(coz::thread_pool& pool, demo::channel& chan, long n)
+    COZ_BEG(demo::job_init, (pool, chan, n), long i = 0; long sum = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != n; ++i) {
+        COZ_AWAIT_LET(long v, chan.receive()) {
+            sum += v;
+        }
+    }
+    demo::g_sum.fetch_add(sum, std::memory_order_relaxed);
+}
+COZ_END
+
+// Returns the elapsed time in ns.
+double bench(unsigned threads, int pairs, long messages) {
+    const long n = messages / pairs;
+    demo::channel chan;
+    std::vector<demo::job> v;
+    v.reserve(2 * pairs);
+    // Destroyed before the jobs, so no worker is still returning from them.
+    coz::thread_pool pool(threads);
+    for (int i = 0; i != pairs; ++i) {
+        v.push_back(consumer(pool, chan, n));
+        v.push_back(producer(pool, chan, n));
+    }
+    demo::g_sum.store(0);
+    demo::g_remaining.store(2 * pairs);
+    const auto beg = std::chrono::steady_clock::now();
+    for (auto& job : v)
+        job.start();
+    for (int k; (k = demo::g_remaining.load()) != 0;)
+        demo::g_remaining.wait(k);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    if (demo::g_sum.load() != pairs * (n * (n - 1) / 2))
+        std::cout << "  wrong sum: " << demo::g_sum.load() << '\n';
+    return elapsed.count();
+}
+
+int main(int argc, char**) {
+    const unsigned threads = std::thread::hardware_concurrency();
+    const long messages = 1 << (21 + argc - 1);
+    std::cout << "threads: " << threads << ", capacity "
+              << demo::channel::capacity() << '\n';
+    for (const int pairs : {1, 2, 8, 32}) {
+        const double ns = bench(threads, pairs, messages);
+        std::cout << "  " << pairs << " producers, " << pairs
+                  << " consumers: " << ns / double(messages) << " ns/msg, "
+                  << double(messages) * 1e3 / ns << " M msg/s\n";
+    }
+}
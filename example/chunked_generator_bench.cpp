@@ -0,0 +1,53 @@
+// Compare consuming the values one by one with consuming them in chunks, where
+// the inner loop over a chunk can be vectorized. The body is so cheap that the
+// loop filling the buffer, whose counter lives in the frame, dominates both, so
+// they come out about even.
+#include <chrono>
+#include <cstdint>
+#include <iostream>
+#include <coz/generator.hpp>
+
+auto squares(int n) COZ_BEG(coz::generator<std::uint64_t>, (n), int i = 0;) {
+    for (; i != n; ++i) {
+        COZ_YIELD(std::uint64_t(i) * std::uint64_t(i));
+    }
+}
+COZ_END
+
+auto squares_chunked(int n)
+    COZ_BEG((coz::chunked_generator<std::uint64_t, 256>), (n), int i = 0;) {
+    for (; i != n; ++i) {
+        COZ_YIELD(std::uint64_t(i) * std::uint64_t(i));
+    }
+}
+COZ_END
+
+template<class F>
+void bench(const char* name, int n, F f) {
+    const auto beg = std::chrono::steady_clock::now();
+    const std::uint64_t sum = f(n);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() / n << " ns/element (" << sum
+              << ")\n";
+}
+
+int main(int argc, char**) {
+    const int n = 100'000'000 + argc - 1;
+    bench("per element", n, [](int n) {
+        std::uint64_t s = 0;
+        for (const std::uint64_t v : squares(n)) {
+            s += v;
+        }
+        return s;
+    });
+    bench("chunked", n, [](int n) {
+        std::uint64_t s = 0;
+        for (const auto chunk : squares_chunked(n)) {
+            for (const std::uint64_t v : chunk) {
+                s += v;
+            }
+        }
+        return s;
+    });
+}
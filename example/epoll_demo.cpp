@@ -0,0 +1,149 @@
+// Ping-pong and a bulk transfer over a socket pair with coz::epoll_context,
+// and count the allocations on the I/O path.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <fcntl.h>
+#include <sys/socket.h>
+#include <coz/epoll.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::size_t g_allocs = 0;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 160>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    char g_buf[2][1 << 16];
+} // namespace demo
+
+void* operator new(std::size_t size) {
+    ++demo::g_allocs;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto ping(coz::epoll_descriptor& d, int rounds)
+    COZ_BEG(demo::job_init, (d, rounds), int i = 0; ssize_t n; char buf[8];) {
+    for (; i != rounds; ++i) {
+        COZ_AWAIT_SET(n, d.async_send("ping", 4));
+        COZ_AWAIT_SET(n, d.async_recv(buf, sizeof(buf)));
+        if (n != 4) {
+            std::cout << "ping: " << n << '\n';
+            COZ_RETURN();
+        }
+    }
+}
+COZ_END
+
+auto pong(coz::epoll_descriptor& d)
+    COZ_BEG(demo::job_init, (d), ssize_t n; char buf[8];) {
+    for (;;) {
+        COZ_AWAIT_SET(n, d.async_recv(buf, sizeof(buf)));
+        if (n <= 0)
+            break;
+        COZ_AWAIT_SET(n, d.async_send(buf, std::size_t(n)));
+    }
+}
+COZ_END
+
+// Most writes fill the socket buffer, so they suspend.
+auto sink(coz::epoll_descriptor& d, std::size_t total)
+    COZ_BEG(demo::job_init, (d, total), ssize_t n;) {
+    while (total) {
+        COZ_AWAIT_SET(n, d.async_write(demo::g_buf[0], sizeof(demo::g_buf[0])));
+        if (n < 0)
+            break;
+        total -= std::size_t(n) < total ? std::size_t(n) : total;
+    }
+    ::shutdown(d.native_handle(), SHUT_WR);
+}
+COZ_END
+
+auto drain(coz::epoll_descriptor& d, std::size_t& total)
+    COZ_BEG(demo::job_init, (d, total), ssize_t n;) {
+    for (;;) {
+        COZ_AWAIT_SET(n, d.async_read(demo::g_buf[1], sizeof(demo::g_buf[1])));
+        if (n <= 0)
+            break;
+        total += std::size_t(n);
+    }
+}
+COZ_END
+
+template<class F>
+void measure(const char* name, int count, F f) {
+    const std::size_t allocs = demo::g_allocs;
+    const auto beg = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() / count << " ns, "
+              << demo::g_allocs - allocs << " allocations\n";
+}
+
+int main() {
+    coz::epoll_context ctx;
+    const int count = 100000;
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM | SOCK_NONBLOCK, 0, fds) != 0)
+        return 1;
+    {
+        coz::epoll_descriptor a(ctx, fds[0]);
+        coz::epoll_descriptor b(ctx, fds[1]);
+        measure("round trip", count, [&] {
+            demo::job x = ping(a, count);
+            demo::job y = pong(b);
+            y.start();
+            x.start();
+            while (!x.done())
+                ctx.run_one();
+            // 'y' is destroyed while waiting for the next message.
+        });
+
+        const std::size_t total = std::size_t(64) << 20;
+        std::size_t received = 0;
+        measure("bulk (per MiB)", int(total >> 20), [&] {
+            demo::job x = sink(a, total);
+            demo::job y = drain(b, received);
+            x.start();
+            y.start();
+            ctx.run();
+        });
+        std::cout << "received: " << received << " bytes\n";
+    }
+    std::cout << "waiting: " << ctx.waiting() << '\n';
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
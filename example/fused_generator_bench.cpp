@@ -0,0 +1,61 @@
+// Compare std::views adaptors over a generator with the fused ones, which
+// skip the suspension for the elements that are filtered out. The generator is
+// inlined into the loop, so both are bound by its counter in the frame.
+#include <chrono>
+#include <ranges>
+#include <iostream>
+#include <coz/fused_generator.hpp>
+
+template<class Pipe>
+auto iota(int n, Pipe pipe)
+    COZ_BEG(coz::generator<int> | pipe, (n), int i = 0;) {
+    for (; i != this->n; ++i) {
+        COZ_YIELD(i);
+    }
+}
+COZ_END
+
+constexpr auto is_even = [](int v) { return v % 2 == 0; };
+constexpr auto square = [](int v) { return unsigned(v) * unsigned(v); };
+
+template<class F>
+void bench(const char* name, int n, F f) {
+    const auto beg = std::chrono::steady_clock::now();
+    const unsigned sum = f(n);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() / n << " ns/element (" << sum
+              << ")\n";
+}
+
+int main(int argc, char**) {
+    const int n = 100'000'000 + argc - 1;
+    bench("std::views", n, [](int n) {
+        unsigned s = 0;
+        for (const unsigned v : iota(n, coz::fuse::identity) |
+                                    std::views::filter(is_even) |
+                                    std::views::transform(square)) {
+            s += v;
+        }
+        return s;
+    });
+    bench("fused", n, [](int n) {
+        unsigned s = 0;
+        for (const unsigned v :
+             iota(n, coz::fuse::filter(is_even) | coz::fuse::map(square))) {
+            s += v;
+        }
+        return s;
+    });
+    bench("fused chunks", n, [](int n) {
+        unsigned s = 0;
+        for (const auto chunk :
+             iota(n, coz::fuse::filter(is_even) | coz::fuse::map(square) |
+                         coz::fuse::chunk<256>())) {
+            for (const unsigned v : chunk) {
+                s += v;
+            }
+        }
+        return s;
+    });
+}
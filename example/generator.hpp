@@ -21,7 +21,9 @@ namespace demo {
 
         void return_void() noexcept {}
 
+#if !defined(COZ_NO_EXCEPTIONS)
         void unhandled_exception() { throw; }
+#endif
 
         std::optional<T> m_data;
     };
@@ -34,6 +36,8 @@ namespace demo {
             : m_coro(coz::default_init<promise>{}),
               m_params(std::move(params)) {}
 
+        generator_impl(generator_impl&&) = default;
+
         ~generator_impl() {
             if (!m_coro.done())
                 m_coro.destroy();
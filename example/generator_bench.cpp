@@ -0,0 +1,71 @@
+// Compare coz::generator with a hand-written loop and the demo generator.
+#include <chrono>
+#include <iostream>
+#include <coz/generator.hpp>
+#include "generator.hpp"
+
+auto coz_iota(int n) COZ_BEG(coz::generator<int>, (n), int i = 0;) {
+    for (; i != n; ++i) {
+        COZ_YIELD(i);
+    }
+}
+COZ_END
+
+auto coz_iota_ref(int n) COZ_BEG((coz::generator<int, coz::by_reference>),
+                                 (n), int i = 0;) {
+    for (; i != n; ++i) {
+        COZ_YIELD(i);
+    }
+}
+COZ_END
+
+auto demo_iota(int n) COZ_BEG(demo::generator<int>, (n), int i = 0;) {
+    for (; i != n; ++i) {
+        COZ_YIELD(i);
+    }
+}
+COZ_END
+
+// Keep the loops scalar, so that the per-element cost is compared.
+#if defined(__GNUC__)
+#define NO_VECTORIZE(s) asm("" : "+r"(s))
+#else
+#define NO_VECTORIZE(s)
+#endif
+
+template<class F>
+void bench(const char* name, int n, F f) {
+    const auto beg = std::chrono::steady_clock::now();
+    const long long sum = f(n);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() / n << " ns/element (" << sum
+              << ")\n";
+}
+
+template<class G>
+long long sum(G&& g) {
+    long long s = 0;
+    for (const auto i : g) {
+        s += i;
+        NO_VECTORIZE(s);
+    }
+    return s;
+}
+
+int main(int argc, char**) {
+    // Not a constant, so that the loop can't be folded.
+    const int n = 100'000'000 + argc - 1;
+    bench("loop", n, [](int n) {
+        long long s = 0;
+        for (int i = 0; i != n; ++i) {
+            s += i;
+            NO_VECTORIZE(s);
+        }
+        return s;
+    });
+    bench("coz::generator", n, [](int n) { return sum(coz_iota(n)); });
+    bench("coz::generator by_reference", n,
+          [](int n) { return sum(coz_iota_ref(n)); });
+    bench("demo::generator", n, [](int n) { return sum(demo_iota(n)); });
+}
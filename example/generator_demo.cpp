@@ -1,4 +1,5 @@
 #include <iostream>
+#include <string>
 #include "generator.hpp"
 
 auto range(int i, int e) COZ_BEG(demo::generator<int>, (i, e)) {
@@ -8,8 +9,29 @@ auto range(int i, int e) COZ_BEG(demo::generator<int>, (i, e)) {
 }
 COZ_END
 
+// The string only lives in the scope. `break` leaves the scope, the loop goes
+// on with the next number.
+auto evens(int n) COZ_BEG(demo::generator<std::string>, (n), int i;) {
+    for (i = 0; i != n; ++i) {
+        COZ_SCOPE(s, std::string text;) {
+            if (i % 2)
+                break;
+            s.text = "even " + std::to_string(i);
+            COZ_YIELD(s.text);
+        }
+    }
+}
+COZ_END
+
 int main() {
     for (const auto i : range(0, 10)) {
         std::cout << i << ',';
     }
+    std::cout << '\n';
+    std::string all;
+    for (const auto& s : evens(5)) {
+        all += s + ',';
+    }
+    std::cout << all << '\n';
+    return all == "even 0,even 2,even 4," ? 0 : 1;
 }
\ No newline at end of file
@@ -0,0 +1,89 @@
+#include <iostream>
+#include <string>
+#include <string_view>
+#include <vector>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void yield_value(std::string_view step) { m_step = step; }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+
+        std::string_view m_step;
+    };
+
+    using job = coz::inplace_task<job_promise, 96>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto count(int n) COZ_BEG(demo::job_init, (n), int i;) {
+    for (i = 0; i != n; ++i) {
+        COZ_YIELD("count");
+    }
+}
+COZ_END
+
+auto greet(std::string_view name) COZ_BEG(demo::job_init, (name)) {
+    COZ_YIELD("hello");
+    COZ_YIELD(name);
+}
+COZ_END
+
+auto label(int n) COZ_BEG(demo::job_init, (n), std::string s;) {
+    s = "long enough to allocate, job #" + std::to_string(n);
+    COZ_YIELD(s);
+}
+COZ_END
+
+int main() {
+    // Coroutines of different types in a single vector.
+    std::vector<demo::job> jobs;
+    jobs.push_back(count(3));
+    jobs.push_back(greet("world"));
+    jobs.push_back(count(1));
+    for (auto& j : jobs) {
+        j.start();
+    }
+    for (bool busy = true; busy;) {
+        busy = false;
+        for (auto& j : jobs) {
+            if (!j.done()) {
+                std::cout << j.promise().m_step << ',';
+                j.resume();
+                busy = true;
+            }
+        }
+        std::cout << '\n';
+    }
+
+    // A destroyed job is done, so the destructor doesn't destroy it again.
+    {
+        demo::job j = label(1);
+        j.start();
+        std::cout << j.promise().m_step << '\n';
+        j.destroy();
+        if (!j.done())
+            return 1;
+    }
+}
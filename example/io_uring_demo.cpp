@@ -0,0 +1,122 @@
+// Ping-pong over a socket pair with coz::io_uring_context, and count the
+// allocations on the I/O path.
+#include <chrono>
+#include <cstdlib>
+#include <iostream>
+#include <new>
+#include <sys/socket.h>
+#include <coz/io_uring.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::size_t g_allocs = 0;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 160>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+} // namespace demo
+
+void* operator new(std::size_t size) {
+    ++demo::g_allocs;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto ping(coz::io_uring_context& io, int fd, int rounds)
+    COZ_BEG(demo::job_init, (io, fd, rounds), int i = 0; int n;
+            char buf[8];) {
+    for (; i != rounds; ++i) {
+        COZ_AWAIT_SET(n, io.send(fd, "ping", 4));
+        COZ_AWAIT_SET(n, io.recv(fd, buf, sizeof(buf)));
+        if (n != 4) {
+            std::cout << "ping: " << n << '\n';
+            COZ_RETURN();
+        }
+    }
+}
+COZ_END
+
+auto pong(coz::io_uring_context& io, int fd)
+    COZ_BEG(demo::job_init, (io, fd), int n; char buf[8];) {
+    for (;;) {
+        COZ_AWAIT_SET(n, io.recv(fd, buf, sizeof(buf)));
+        if (n <= 0)
+            break;
+        COZ_AWAIT_SET(n, io.send(fd, buf, unsigned(n)));
+    }
+}
+COZ_END
+
+auto nops(coz::io_uring_context& io, int count)
+    COZ_BEG(demo::job_init, (io, count), int i = 0;) {
+    for (; i != count; ++i)
+        COZ_AWAIT(io.nop());
+}
+COZ_END
+
+template<class F>
+void measure(const char* name, int count, F f) {
+    const std::size_t allocs = demo::g_allocs;
+    const auto beg = std::chrono::steady_clock::now();
+    f();
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() / count << " ns, "
+              << demo::g_allocs - allocs << " allocations\n";
+}
+
+int main() {
+    coz::io_uring_context io;
+    const int count = 100000;
+
+    measure("nop", count, [&] {
+        demo::job job = nops(io, count);
+        job.start();
+        io.run();
+    });
+
+    int fds[2];
+    if (::socketpair(AF_UNIX, SOCK_STREAM, 0, fds) != 0)
+        return 1;
+    measure("round trip", count, [&] {
+        demo::job a = ping(io, fds[0], count);
+        demo::job b = pong(io, fds[1]);
+        b.start();
+        a.start();
+        while (!a.done())
+            io.run_one();
+        // 'b' is destroyed while waiting for the next message, which
+        // cancels its recv.
+    });
+    std::cout << "pending: " << io.pending() << '\n';
+    ::close(fds[0]);
+    ::close(fds[1]);
+}
@@ -0,0 +1,166 @@
+// Compare the recursion of coz::recursive_task, whose frames are pushed to an
+// arena, with the one of C++20 coroutines, which allocate on every call.
+#include <chrono>
+#include <coroutine>
+#include <exception>
+#include <iostream>
+#include <memory>
+#include <string>
+#include <utility>
+#include <coz/recursive_task.hpp>
+
+coz::recursive_task<long> coz_fib(coz::frame_arena& arena, int n)
+    COZ_BEG(coz::recursive<long>(arena), (arena, n), long a; long b;) {
+    if (n < 2) {
+        COZ_RETURN(n);
+    }
+    COZ_AWAIT_SET(a, coz_fib(arena, n - 1));
+    COZ_AWAIT_SET(b, coz_fib(arena, n - 2));
+    COZ_RETURN(a + b);
+}
+COZ_END
+
+// Suspends until destroyed.
+struct park {
+    bool await_ready() const noexcept { return false; }
+
+    void await_suspend(coz::coroutine_handle<>) const noexcept {}
+
+    void await_resume() const noexcept {}
+};
+
+// Nests n tasks, each holding a string, and parks the innermost one.
+coz::recursive_task<> nest(coz::frame_arena& arena, int n)
+    COZ_BEG(coz::recursive<>(arena), (arena, n), std::string s;) {
+    s.assign(64, char('a' + n));
+    if (n == 0) {
+        COZ_AWAIT(park());
+    } else {
+        COZ_AWAIT(nest(arena, n - 1));
+    }
+}
+COZ_END
+
+namespace std_coro {
+    template<class T>
+    struct task {
+        struct promise_type {
+            task get_return_object() {
+                return task(
+                    std::coroutine_handle<promise_type>::from_promise(*this));
+            }
+
+            std::suspend_always initial_suspend() noexcept { return {}; }
+
+            auto final_suspend() noexcept {
+                struct awaiter {
+                    bool await_ready() noexcept { return false; }
+
+                    std::coroutine_handle<>
+                    await_suspend(std::coroutine_handle<promise_type> h) noexcept {
+                        return h.promise().m_cont;
+                    }
+
+                    void await_resume() noexcept {}
+                };
+                return awaiter{};
+            }
+
+            void return_value(T v) noexcept { m_value = v; }
+
+            void unhandled_exception() { std::terminate(); }
+
+            std::coroutine_handle<> m_cont = std::noop_coroutine();
+            T m_value{};
+        };
+
+        explicit task(std::coroutine_handle<promise_type> h) : m_coro(h) {}
+
+        task(task&& other) noexcept
+            : m_coro(std::exchange(other.m_coro, nullptr)) {}
+
+        ~task() {
+            if (m_coro)
+                m_coro.destroy();
+        }
+
+        bool await_ready() noexcept { return false; }
+
+        std::coroutine_handle<> await_suspend(std::coroutine_handle<> cont) {
+            m_coro.promise().m_cont = cont;
+            return m_coro;
+        }
+
+        T await_resume() { return m_coro.promise().m_value; }
+
+        T get() {
+            m_coro.resume();
+            return m_coro.promise().m_value;
+        }
+
+        std::coroutine_handle<promise_type> m_coro;
+    };
+
+    task<long> fib(int n) {
+        if (n < 2) {
+            co_return n;
+        }
+        const long a = co_await fib(n - 1);
+        const long b = co_await fib(n - 2);
+        co_return a + b;
+    }
+} // namespace std_coro
+
+// The symmetric transfers of C++20 coroutines only run in constant stack space
+// if they become tail calls, which needs optimizations and no ASan. Otherwise
+// every transfer nests, and fib(30) overflows the stack.
+#if defined(__SANITIZE_ADDRESS__)
+#define STD_CORO_TAIL_CALLS 0
+#elif defined(__has_feature)
+#if __has_feature(address_sanitizer)
+#define STD_CORO_TAIL_CALLS 0
+#endif
+#endif
+#if !defined(STD_CORO_TAIL_CALLS)
+#if defined(__OPTIMIZE__) || (defined(_MSC_VER) && defined(NDEBUG))
+#define STD_CORO_TAIL_CALLS 1
+#else
+#define STD_CORO_TAIL_CALLS 0
+#endif
+#endif
+
+template<class F>
+void bench(const char* name, F f) {
+    const auto beg = std::chrono::steady_clock::now();
+    const long v = f();
+    const std::chrono::duration<double, std::milli> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() << " ms (" << v << ")\n";
+}
+
+int main() {
+    constexpr int n = 30;
+    auto buf = std::make_unique<std::byte[]>(64 * 1024);
+    coz::frame_arena arena({buf.get(), 64 * 1024});
+    bench("coz::recursive_task", [&] {
+        auto t = coz_fib(arena, n);
+        t.start();
+        return t.get();
+    });
+#if STD_CORO_TAIL_CALLS
+    bench("std coroutine", [&] { return std_coro::fib(n).get(); });
+#else
+    std::cout << "std coroutine: skipped, no guaranteed tail calls in this "
+                 "build\n";
+#endif
+
+    // Dropping a suspended task cancels its children, each frame is destroyed
+    // once and popped from the arena.
+    {
+        auto t = nest(arena, 3);
+        t.start();
+        if (t.done())
+            return 1;
+    }
+    return arena.used() == 0 ? 0 : 1;
+}
@@ -0,0 +1,28 @@
+#include <iostream>
+#include <vector>
+#include "generator.hpp"
+
+auto range(int i, int e) COZ_BEG(demo::generator<int>, (i, e)) {
+    for (; i != e; ++i) {
+        COZ_YIELD(i);
+    }
+}
+COZ_END
+
+int main() {
+    std::vector<decltype(range(0, 0))> gens;
+    for (int i = 0; i != 8; ++i) {
+        auto& g = gens.emplace_back(range(i * 10, i * 10 + 4));
+        // Suspend at the first value, and the vector relocates the
+        // suspended generators while it grows.
+        std::cout << *g.begin() << ',';
+    }
+    std::cout << '\n';
+    for (auto& g : gens) {
+        // On a suspended generator, begin() resumes to the next value.
+        for (auto it = g.begin(); it != g.end(); ++it) {
+            std::cout << *it << ',';
+        }
+        std::cout << '\n';
+    }
+}
@@ -0,0 +1,32 @@
+// The cost of resuming a generator, which dispatches through the switch of
+// the body. Build with and without -fno-exceptions to compare them.
+#include <chrono>
+#include <iostream>
+#include "generator.hpp"
+
+auto numbers(int n) COZ_BEG(demo::generator<int>, (n), int i = 0;) {
+    for (i = 0; i != n; ++i) {
+        COZ_YIELD(i);
+        COZ_YIELD(i ^ 1);
+        COZ_YIELD(i ^ 2);
+        COZ_YIELD(i ^ 3);
+    }
+}
+COZ_END
+
+int main() {
+    constexpr int n = 50'000'000;
+    const auto beg = std::chrono::steady_clock::now();
+    long long sum = 0;
+    for (const auto i : numbers(n)) {
+        sum += i;
+    }
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+#if defined(COZ_NO_EXCEPTIONS)
+    std::cout << "no exceptions: ";
+#else
+    std::cout << "exceptions: ";
+#endif
+    std::cout << elapsed.count() / (4.0 * n) << " ns/resume (" << sum << ")\n";
+}
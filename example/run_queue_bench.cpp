@@ -0,0 +1,120 @@
+// Compare a run queue that links the frames with one of handles in a deque.
+#include <chrono>
+#include <deque>
+#include <vector>
+#include <iostream>
+#include <coz/coro_queue.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    struct job_promise {
+        using coz_intrusive_link = void;
+
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 96>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    struct intrusive_scheduler {
+        struct awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(coz::coroutine_handle<job_promise> coro) {
+                m_queue->push_back(coro);
+            }
+
+            void await_resume() const noexcept {}
+
+            coz::coro_queue* m_queue;
+        };
+
+        awaiter schedule() noexcept { return {&m_queue}; }
+
+        void run() {
+            while (!m_queue.empty())
+                m_queue.pop_front().resume();
+        }
+
+        coz::coro_queue m_queue;
+    };
+
+    struct deque_scheduler {
+        struct awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(coz::coroutine_handle<> coro) {
+                m_queue->push_back(coro);
+            }
+
+            void await_resume() const noexcept {}
+
+            std::deque<coz::coroutine_handle<>>* m_queue;
+        };
+
+        awaiter schedule() noexcept { return {&m_queue}; }
+
+        void run() {
+            while (!m_queue.empty()) {
+                auto coro = m_queue.front();
+                m_queue.pop_front();
+                coro.resume();
+            }
+        }
+
+        std::deque<coz::coroutine_handle<>> m_queue;
+    };
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+template<class Scheduler>
+auto worker(Scheduler& sched, int n)
+    COZ_BEG(demo::job_init, (sched, n), int i = 0;) {
+    for (; i != this->n; ++i) {
+        COZ_AWAIT(this->sched.schedule());
+    }
+}
+COZ_END
+
+template<class Scheduler>
+void bench(const char* name, int jobs, int n) {
+    Scheduler sched;
+    std::vector<demo::job> v;
+    v.reserve(jobs);
+    for (int i = 0; i != jobs; ++i)
+        v.push_back(worker(sched, n));
+    const auto beg = std::chrono::steady_clock::now();
+    for (auto& job : v)
+        job.start();
+    sched.run();
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": " << elapsed.count() / (double(jobs) * n)
+              << " ns/switch\n";
+}
+
+int main(int argc, char**) {
+    const int jobs = 10'000 + argc - 1;
+    const int n = 10'000;
+    bench<demo::deque_scheduler>("std::deque", jobs, n);
+    bench<demo::intrusive_scheduler>("coz::coro_queue", jobs, n);
+}
@@ -0,0 +1,156 @@
+// One producer and one consumer, each on its own single-threaded
+// coz::thread_pool: coz::spsc_channel against coz::channel, and
+// coz::spsc_channel between two plain threads.
+#include <atomic>
+#include <chrono>
+#include <thread>
+#include <iostream>
+#include <coz/channel.hpp>
+#include <coz/spsc_channel.hpp>
+#include <coz/thread_pool.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::atomic<int> g_remaining;
+    std::atomic<long> g_sum;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {
+            if (g_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                g_remaining.notify_all();
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 160>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    constexpr std::size_t capacity = 256;
+
+    using spsc = coz::spsc_channel<long, capacity>;
+    using mpmc = coz::channel<long, capacity>;
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto spsc_producer(coz::thread_pool& pool, demo::spsc& chan, long n)
+    COZ_BEG(demo::job_init, (pool, chan, n), long i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != n; ++i)
+        COZ_AWAIT(chan.send(i, pool));
+    chan.flush();
+}
+COZ_END
+
+auto spsc_consumer(coz::thread_pool& pool, demo::spsc& chan, long n)
+    COZ_BEG(demo::job_init, (pool, chan, n), long i = 0; long sum = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != n; ++i) {
+        COZ_AWAIT_LET(long v, chan.receive(pool)) {
+            sum += v;
+        }
+    }
+    demo::g_sum.store(sum);
+}
+COZ_END
+
+auto mpmc_producer(coz::thread_pool& pool, demo::mpmc& chan, long n)
+    COZ_BEG(demo::job_init, (pool, chan, n), long i = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != n; ++i)
+        COZ_AWAIT(chan.send(i));
+}
+COZ_END
+
+auto mpmc_consumer(coz::thread_pool& pool, demo::mpmc& chan, long n)
+    COZ_BEG(demo::job_init, (pool, chan, n), long i = 0; long sum = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != n; ++i) {
+        COZ_AWAIT_LET(long v, chan.receive()) {
+            sum += v;
+        }
+    }
+    demo::g_sum.store(sum);
+}
+COZ_END
+
+using clock_type = std::chrono::steady_clock;
+
+double elapsed_ns(clock_type::time_point beg) {
+    const std::chrono::duration<double, std::nano> d = clock_type::now() - beg;
+    return d.count();
+}
+
+void wait_all() {
+    for (int k; (k = demo::g_remaining.load()) != 0;)
+        demo::g_remaining.wait(k);
+}
+
+void report(const char* name, double ns, long n) {
+    std::cout << "  " << name << ": " << ns / double(n) << " ns/msg";
+    if (demo::g_sum.load() != n * (n - 1) / 2)
+        std::cout << " (wrong sum)";
+    std::cout << '\n';
+}
+
+int main(int argc, char**) {
+    const long n = 1 << (22 + argc - 1);
+    std::cout << "capacity " << demo::capacity << ", spsc batch "
+              << demo::spsc::batch << ":\n";
+    {
+        demo::spsc chan;
+        coz::thread_pool producer_pool(1), consumer_pool(1);
+        demo::job consumer = spsc_consumer(consumer_pool, chan, n);
+        demo::job producer = spsc_producer(producer_pool, chan, n);
+        demo::g_remaining.store(2);
+        const auto beg = clock_type::now();
+        consumer.start();
+        producer.start();
+        wait_all();
+        report("spsc_channel", elapsed_ns(beg), n);
+    }
+    {
+        demo::mpmc chan;
+        coz::thread_pool producer_pool(1), consumer_pool(1);
+        demo::job consumer = mpmc_consumer(consumer_pool, chan, n);
+        demo::job producer = mpmc_producer(producer_pool, chan, n);
+        demo::g_remaining.store(2);
+        const auto beg = clock_type::now();
+        consumer.start();
+        producer.start();
+        wait_all();
+        report("channel", elapsed_ns(beg), n);
+    }
+    {
+        demo::spsc chan;
+        const auto beg = clock_type::now();
+        std::thread producer([&] {
+            for (long i = 0; i != n; ++i)
+                chan.send_blocking(i);
+            chan.flush();
+        });
+        long sum = 0;
+        for (long i = 0; i != n; ++i)
+            sum += chan.receive_blocking();
+        producer.join();
+        demo::g_sum.store(sum);
+        report("spsc_channel, threads", elapsed_ns(beg), n);
+    }
+}
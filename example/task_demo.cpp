@@ -0,0 +1,43 @@
+#include <iostream>
+#include <stdexcept>
+#include <coz/task.hpp>
+#include "generator.hpp"
+
+auto square(int x) COZ_BEG(coz::task<int>, (x)) {
+    COZ_RETURN(x * x);
+}
+COZ_END
+
+auto sum_squares(int n) COZ_BEG(coz::task<int>, (n), int i = 0; int sum = 0;) {
+    for (; i != n; ++i) {
+        // The frame of 'square' is embedded in the one of 'sum_squares'.
+        sum += COZ_AWAIT(square(i));
+    }
+    if (sum > 100) {
+        throw std::out_of_range("too large");
+    }
+    COZ_RETURN(sum);
+}
+COZ_END
+
+auto run(int n) COZ_BEG(demo::generator<int>, (n), int i = 1; int sum;) {
+    for (; i <= n; ++i) {
+        COZ_TRY {
+            COZ_AWAIT_SET(sum, sum_squares(i));
+            COZ_YIELD(sum);
+        }
+        COZ_CATCH(const std::exception& e) {
+            std::cout << "error: " << e.what() << '\n';
+        }
+    }
+}
+COZ_END
+
+int main() {
+    for (const auto i : run(8)) {
+        std::cout << i << '\n';
+    }
+    std::cout << "sizeof(square): " << sizeof(square(0))
+              << ", sizeof(sum_squares): " << sizeof(sum_squares(0))
+              << ", sizeof(run): " << sizeof(run(0)) << '\n';
+}
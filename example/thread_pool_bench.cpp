@@ -0,0 +1,102 @@
+// Throughput of coz::thread_pool from 1 to N threads, with jobs that do some
+// work between the yields.
+#include <atomic>
+#include <chrono>
+#include <vector>
+#include <iostream>
+#include <coz/thread_pool.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::atomic<int> g_remaining;
+    std::atomic<unsigned> g_sink;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {
+            if (g_remaining.fetch_sub(1, std::memory_order_acq_rel) == 1)
+                g_remaining.notify_all();
+        }
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 128>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    unsigned spin(unsigned x, int n) {
+        for (int i = 0; i != n; ++i)
+            x = x * 1664525u + 1013904223u;
+        return x;
+    }
+} // namespace demo
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+auto worker(coz::thread_pool& pool, int yields, int work)
+    COZ_BEG(demo::job_init, (pool, yields, work), int i = 0; unsigned x = 0;) {
+    COZ_AWAIT(pool.schedule());
+    for (; i != yields; ++i) {
+        x = demo::spin(x + i, work);
+        COZ_AWAIT(pool.schedule());
+    }
+    demo::g_sink.fetch_add(x, std::memory_order_relaxed);
+}
+COZ_END
+
+// Returns the elapsed time in ns.
+double bench(unsigned threads, int jobs, int yields, int work) {
+    std::vector<demo::job> v;
+    v.reserve(jobs);
+    // Destroyed before the jobs, so no worker is still returning from them.
+    coz::thread_pool pool(threads);
+    for (int i = 0; i != jobs; ++i)
+        v.push_back(worker(pool, yields, work));
+    demo::g_remaining.store(jobs);
+    const auto beg = std::chrono::steady_clock::now();
+    for (auto& job : v)
+        job.start();
+    for (int n; (n = demo::g_remaining.load()) != 0;)
+        demo::g_remaining.wait(n);
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    return elapsed.count();
+}
+
+int main(int argc, char**) {
+    const unsigned max_threads = std::thread::hardware_concurrency();
+    const int jobs = 1000 + argc - 1;
+    const int yields = 1000;
+    std::cout << "hardware threads: " << max_threads << '\n';
+    for (const int work : {0, 100}) {
+        std::cout << "work " << work << ":\n";
+        double base = 0;
+        for (unsigned threads = 1;; threads *= 2) {
+            if (threads > max_threads)
+                threads = max_threads;
+            const double ns = bench(threads, jobs, yields, work);
+            if (threads == 1)
+                base = ns;
+            std::cout << "  " << threads << " threads: "
+                      << ns / (double(jobs) * yields) << " ns/yield, speedup "
+                      << base / ns << '\n';
+            if (threads == max_threads)
+                break;
+        }
+    }
+}
@@ -0,0 +1,163 @@
+// Set timers and cancel them before they fire, which is the common case of
+// timeouts, with coz::timer_wheel and with a std::multimap. It also checks the
+// order in which coz::timer_wheel fires the timers.
+#include <chrono>
+#include <cstdlib>
+#include <map>
+#include <new>
+#include <vector>
+#include <iostream>
+#include <coz/timer_wheel.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace demo {
+    std::size_t g_allocs = 0;
+    // The ids of the fired timers, see 'check_order'.
+    std::vector<int> g_fired;
+
+    struct job_promise {
+        explicit job_promise(coz::default_init<job_promise>) noexcept {}
+
+        void finalize() noexcept {}
+
+        void return_void() noexcept {}
+
+        void unhandled_exception() { throw; }
+    };
+
+    using job = coz::inplace_task<job_promise, 160>;
+
+    constexpr coz::default_init<job_promise> job_init{};
+
+    struct multimap_timers {
+        using clock = std::chrono::steady_clock;
+        using map = std::multimap<clock::time_point, coz::coroutine_handle<>>;
+
+        struct awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(coz::coroutine_handle<> coro) {
+                m_it = m_map->emplace(m_deadline, coro);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_map->erase(m_it); }
+
+            map* m_map;
+            clock::time_point m_deadline;
+            map::iterator m_it;
+        };
+
+        template<class Rep, class Period>
+        awaiter sleep_for(std::chrono::duration<Rep, Period> d) noexcept {
+            return {&m_map, clock::now() + d, {}};
+        }
+
+        map m_map;
+    };
+} // namespace demo
+
+void* operator new(std::size_t size) {
+    ++demo::g_allocs;
+    if (void* p = std::malloc(size))
+        return p;
+    throw std::bad_alloc();
+}
+
+void operator delete(void* p) noexcept { std::free(p); }
+
+void operator delete(void* p, std::size_t) noexcept { std::free(p); }
+
+namespace coz {
+    template<class Params, class State>
+    struct co_result<default_init<demo::job_promise>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<demo::job_promise> m_init;
+        Params m_params;
+
+        demo::job get_return_object() {
+            return demo::job(std::in_place_type<State>, m_init,
+                             std::move(m_params));
+        }
+    };
+} // namespace coz
+
+template<class Timers>
+auto request(Timers& timers, int timeout_ms)
+    COZ_BEG(demo::job_init, (timers, timeout_ms)) {
+    COZ_AWAIT(this->timers.sleep_for(
+        std::chrono::milliseconds(this->timeout_ms)));
+}
+COZ_END
+
+auto record(coz::timer_wheel& timers, coz::timer_wheel::clock::time_point at,
+            int id) COZ_BEG(demo::job_init, (timers, at, id)) {
+    COZ_AWAIT(timers.sleep_until(at));
+    demo::g_fired.push_back(id);
+}
+COZ_END
+
+// The timers fire by deadline, and those with the same deadline in the order
+// they were set, even when they were set at different levels of the wheel.
+bool check_order() {
+    using std::chrono::seconds;
+    coz::timer_wheel timers(seconds(1));
+    // The ticks are in seconds from here, give or take one.
+    const auto origin = coz::timer_wheel::clock::now();
+    std::vector<demo::job> jobs;
+    jobs.reserve(7);
+    const auto set = [&](int deadline, int id) {
+        jobs.push_back(record(timers, origin + seconds(deadline), id));
+        jobs.back().start();
+    };
+    const auto expire = [&](int now) { timers.expire(origin + seconds(now)); };
+    set(4200, 1); // Level 2.
+    set(100, 2);  // Level 1.
+    set(5, 3);    // Level 0.
+    set(100, 4);  // Level 1.
+    expire(50);
+    set(100, 5); // Level 0, before 2 and 4 are cascaded to it.
+    set(10, 6);  // Already due.
+    expire(200);
+    set(4200, 7); // Level 1.
+    expire(5000);
+    const std::vector<int> expected{3, 6, 2, 4, 5, 1, 7};
+    std::cout << "firing order:";
+    for (const int id : demo::g_fired)
+        std::cout << ' ' << id;
+    std::cout << '\n';
+    return demo::g_fired == expected;
+}
+
+template<class Timers>
+void bench(const char* name, int jobs, int rounds) {
+    Timers timers;
+    std::vector<demo::job> v(jobs);
+    const std::size_t allocs = demo::g_allocs;
+    const auto beg = std::chrono::steady_clock::now();
+    for (int r = 0; r != rounds; ++r) {
+        // Spread the timeouts, so they land in different slots.
+        for (int i = 0; i != jobs; ++i) {
+            v[i] = request(timers, 1000 + (i * 7919 + r) % 30000);
+            v[i].start();
+        }
+        // Cancelled by the destruction.
+        for (auto& job : v)
+            job = demo::job();
+    }
+    const std::chrono::duration<double, std::nano> elapsed =
+        std::chrono::steady_clock::now() - beg;
+    std::cout << name << ": "
+              << elapsed.count() / (double(jobs) * rounds)
+              << " ns/timer, "
+              << double(demo::g_allocs - allocs) / (double(jobs) * rounds)
+              << " allocations/timer\n";
+}
+
+int main(int argc, char**) {
+    const int jobs = 10'000 + argc - 1;
+    const int rounds = 100;
+    bench<demo::multimap_timers>("std::multimap", jobs, rounds);
+    bench<coz::timer_wheel>("coz::timer_wheel", jobs, rounds);
+    return check_order() ? 0 : 1;
+}
@@ -0,0 +1,140 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_BARRIER_HPP
+#define COZ_ASYNC_BARRIER_HPP
+
+#include <mutex>
+#include <cstddef>
+#include <cassert>
+#include <type_traits>
+#include <coz/async_waiter.hpp>
+
+namespace coz {
+    // Reusable barrier, like std::barrier without the completion function,
+    // whose waiters suspend. The last to arrive doesn't suspend, and
+    // releases the others of the phase. The state is guarded by a spin lock,
+    // which is never held while resuming. A coroutine destroyed while
+    // waiting leaves the barrier, like 'arrive_and_drop'.
+    struct async_barrier {
+        explicit async_barrier(std::ptrdiff_t expected) noexcept
+            : m_expected(expected), m_remaining(expected) {
+            assert(expected > 0);
+        }
+
+        async_barrier(const async_barrier&) = delete;
+        async_barrier& operator=(const async_barrier&) = delete;
+
+        ~async_barrier() { assert(m_waiters.empty()); }
+
+        // 'Scheduler' is void to resume the others inline.
+        template<class Scheduler>
+        struct [[nodiscard]] arrive_awaiter : private detail::async_waiter {
+            bool await_ready() const noexcept { return false; }
+
+            bool await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                detail::waiter_list released;
+                if (!m_barrier->arrive(this, 0, released))
+                    return true;
+                m_barrier->wake(m_sched, released);
+                return false;
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_barrier->cancel(this); }
+
+        private:
+            friend async_barrier;
+
+            arrive_awaiter(async_barrier* barrier, Scheduler* sched) noexcept
+                : m_barrier(barrier), m_sched(sched) {}
+
+            async_barrier* m_barrier;
+            Scheduler* m_sched;
+        };
+
+        // Arrive and wait for the others of the phase, who are resumed here
+        // if this is the last.
+        arrive_awaiter<void> arrive_and_wait() noexcept {
+            return {this, nullptr};
+        }
+
+        // Like above, but the others are posted to the scheduler in batches,
+        // e.g. a 'thread_pool', so the last doesn't run them.
+        template<class Scheduler>
+        arrive_awaiter<Scheduler> arrive_and_wait(Scheduler& sched) noexcept {
+            return {this, &sched};
+        }
+
+        // Arrive without waiting, and expect one less from the next phase.
+        void arrive_and_drop() { drop(static_cast<void*>(nullptr)); }
+
+        template<class Scheduler>
+        void arrive_and_drop(Scheduler& sched) {
+            drop(&sched);
+        }
+
+    private:
+        // Returns true if the phase completes, then the waiters are moved to
+        // 'released'. Otherwise 'w' waits, unless it's null.
+        bool arrive(detail::async_waiter* w, std::ptrdiff_t dropped,
+                    detail::waiter_list& released) noexcept {
+            std::lock_guard guard(m_spin);
+            m_expected -= dropped;
+            assert(m_remaining > 0);
+            if (--m_remaining != 0) {
+                if (w)
+                    m_waiters.push_back(w);
+                return false;
+            }
+            m_remaining = m_expected;
+            released.splice_back(m_waiters);
+            return true;
+        }
+
+        // Its arrival counts for the current phase, and it's not expected
+        // from the next. If the phase has completed, but it wasn't resumed
+        // yet, it's not expected from the new phase either.
+        void cancel(detail::async_waiter* w) noexcept {
+            {
+                std::lock_guard guard(m_spin);
+                if (m_waiters.erase(w)) {
+                    --m_expected;
+                    return;
+                }
+            }
+            if (detail::withdraw_released(w))
+                arrive_and_drop();
+        }
+
+        template<class Scheduler>
+        static void wake(Scheduler* sched, detail::waiter_list& released) {
+            if constexpr (std::is_void_v<Scheduler>) {
+                detail::resume_waiters(released);
+            } else {
+                detail::post_waiters(*sched, released);
+            }
+        }
+
+        template<class Scheduler>
+        void drop(Scheduler* sched) {
+            detail::waiter_list released;
+            if (arrive(nullptr, 1, released))
+                wake(sched, released);
+        }
+
+        detail::spin_lock m_spin;
+        // The number of arrivals for the next phase.
+        std::ptrdiff_t m_expected;
+        // The number of arrivals left for the current phase.
+        std::ptrdiff_t m_remaining;
+        detail::waiter_list m_waiters;
+    };
+} // namespace coz
+
+#endif
@@ -0,0 +1,149 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_CONDITION_VARIABLE_HPP
+#define COZ_ASYNC_CONDITION_VARIABLE_HPP
+
+#include <mutex>
+#include <cassert>
+#include <coz/async_mutex.hpp>
+#include <coz/async_waiter.hpp>
+
+namespace coz {
+    // Condition variable for 'async_mutex'. A notified waiter is queued on
+    // the mutex by the notifier, through the same node in its awaiter, and
+    // resumed once it owns the mutex again, so it never allocates. Spurious
+    // wakeups don't happen, but the condition may have changed before the
+    // waiter reacquires the mutex.
+    //
+    // A coroutine destroyed while waiting leaves the queue. Once notified,
+    // it must not be destroyed until it owns the mutex again, like the
+    // waiters of 'async_mutex'.
+    struct async_condition_variable {
+        async_condition_variable() noexcept = default;
+
+        async_condition_variable(const async_condition_variable&) = delete;
+        async_condition_variable&
+        operator=(const async_condition_variable&) = delete;
+
+        ~async_condition_variable() { assert(m_waiters.empty()); }
+
+    private:
+        struct waiter : detail::async_waiter {
+            async_mutex* m_mutex;
+        };
+
+    public:
+        // The mutex must be locked by the caller, and is locked again on
+        // resumption.
+        struct [[nodiscard]] wait_awaiter : private waiter {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                async_mutex* mutex = m_mutex;
+                m_cv->enqueue(this);
+                // May resume this coroutine, which must not be touched after.
+                mutex->unlock();
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_cv->cancel(this, m_lock); }
+
+        private:
+            friend async_condition_variable;
+
+            wait_awaiter(async_condition_variable* cv, async_mutex* mutex,
+                         async_mutex_lock* lock) noexcept
+                : m_cv(cv), m_lock(lock) {
+                m_mutex = mutex;
+            }
+
+            async_condition_variable* m_cv;
+            // The lock passed to 'wait', if any.
+            async_mutex_lock* m_lock;
+        };
+
+        wait_awaiter wait(async_mutex& mutex) noexcept {
+            return {this, &mutex, nullptr};
+        }
+
+        // Like above, but for the mutex owned by 'lock'.
+        wait_awaiter wait(async_mutex_lock& lock) noexcept {
+            assert(lock.owns_lock());
+            return {this, lock.mutex(), &lock};
+        }
+
+        // The woken waiter is resumed here if the mutex is free, otherwise
+        // when it's unlocked.
+        void notify_one() { detail::resume_waiters(relock(take(false))); }
+
+        void notify_all() { detail::resume_waiters(relock(take(true))); }
+
+        // Like above, but the waiter that gets the free mutex is posted to
+        // the scheduler instead.
+        template<class Scheduler>
+        void notify_one(Scheduler& sched) {
+            detail::post_waiters(sched, relock(take(false)));
+        }
+
+        template<class Scheduler>
+        void notify_all(Scheduler& sched) {
+            detail::post_waiters(sched, relock(take(true)));
+        }
+
+    private:
+        void enqueue(waiter* w) noexcept {
+            std::lock_guard guard(m_spin);
+            m_waiters.push_back(w);
+        }
+
+        // The waiter leaves the queue, then its lock no longer owns the
+        // mutex. Or it got the mutex back but wasn't resumed yet, then the
+        // mutex is unlocked, by its lock if any.
+        void cancel(waiter* w, async_mutex_lock* lock) noexcept {
+            bool erased;
+            {
+                std::lock_guard guard(m_spin);
+                erased = m_waiters.erase(w);
+            }
+            if (erased) {
+                if (lock)
+                    lock->release();
+            } else if (detail::withdraw_released(w) && !lock) {
+                w->m_mutex->unlock();
+            }
+        }
+
+        detail::waiter_list take(bool all) noexcept {
+            detail::waiter_list list;
+            std::lock_guard guard(m_spin);
+            if (all) {
+                list.splice_back(m_waiters);
+            } else if (!m_waiters.empty()) {
+                list.push_back(m_waiters.pop_front());
+            }
+            return list;
+        }
+
+        // Queue the waiters on their mutexes, returns those that got it.
+        static detail::waiter_list relock(detail::waiter_list list) noexcept {
+            detail::waiter_list ready;
+            while (!list.empty()) {
+                auto w = static_cast<waiter*>(list.pop_front());
+                if (!w->m_mutex->enqueue(w))
+                    ready.push_back(w);
+            }
+            return ready;
+        }
+
+        detail::spin_lock m_spin;
+        detail::waiter_list m_waiters;
+    };
+} // namespace coz
+
+#endif
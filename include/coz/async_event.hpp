@@ -0,0 +1,259 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_EVENT_HPP
+#define COZ_ASYNC_EVENT_HPP
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cassert>
+#include <coz/async_waiter.hpp>
+
+namespace coz {
+    // Manual-reset event: 'set' resumes all the waiters, and the later ones
+    // don't suspend until 'reset'. The state is a single atomic word, which
+    // is either 'set', or the stack of the waiters, which are pushed to it
+    // lock-free and resumed in FIFO order.
+    //
+    // A coroutine must not be destroyed while waiting on it.
+    struct async_event {
+        explicit async_event(bool initially_set = false) noexcept
+            : m_state(initially_set ? set_state : 0) {}
+
+        async_event(const async_event&) = delete;
+        async_event& operator=(const async_event&) = delete;
+
+        ~async_event() {
+            assert(m_state.load(std::memory_order_relaxed) == set_state ||
+                   m_state.load(std::memory_order_relaxed) == 0);
+        }
+
+        bool is_set() const noexcept {
+            return m_state.load(std::memory_order_acquire) == set_state;
+        }
+
+        // Resume the waiters here.
+        void set() { detail::resume_waiters(take()); }
+
+        // Like above, but the waiters are posted to the scheduler in batches,
+        // e.g. a 'thread_pool', so the setting thread doesn't run them.
+        template<class Scheduler>
+        void set(Scheduler& sched) {
+            detail::post_waiters(sched, take());
+        }
+
+        // No effect if not set.
+        void reset() noexcept {
+            std::uintptr_t expected = set_state;
+            m_state.compare_exchange_strong(expected, 0,
+                                            std::memory_order_relaxed);
+        }
+
+        struct [[nodiscard]] wait_awaiter : private detail::async_waiter {
+            bool await_ready() const noexcept { return m_event->is_set(); }
+
+            bool await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                return m_event->enqueue(this);
+            }
+
+            void await_resume() const noexcept {}
+
+        private:
+            friend async_event;
+
+            explicit wait_awaiter(async_event* event) noexcept
+                : m_event(event) {}
+
+            async_event* m_event;
+        };
+
+        wait_awaiter wait() noexcept { return wait_awaiter(this); }
+
+    private:
+        static constexpr std::uintptr_t set_state = 1;
+
+        // Returns false if it's set instead.
+        bool enqueue(detail::async_waiter* w) noexcept {
+            std::uintptr_t state = m_state.load(std::memory_order_acquire);
+            do {
+                if (state == set_state)
+                    return false;
+                w->m_next = reinterpret_cast<detail::async_waiter*>(state);
+            } while (!m_state.compare_exchange_weak(
+                state, reinterpret_cast<std::uintptr_t>(w),
+                std::memory_order_release, std::memory_order_acquire));
+            return true;
+        }
+
+        detail::waiter_list take() noexcept {
+            std::uintptr_t state = m_state.load(std::memory_order_relaxed);
+            if (state == set_state)
+                return {};
+            state = m_state.exchange(set_state, std::memory_order_acq_rel);
+            if (state == set_state)
+                return {};
+            return detail::waiter_list::from_stack(
+                reinterpret_cast<detail::async_waiter*>(state));
+        }
+
+        std::atomic<std::uintptr_t> m_state;
+    };
+
+    // Auto-reset event: 'set' resumes one waiter, or lets the next one pass
+    // if none is waiting. The waiters are pushed to a single atomic word
+    // like 'async_event', and the setters move them to a FIFO under a spin
+    // lock, so a waiter is never popped concurrently.
+    struct async_auto_reset_event {
+        explicit async_auto_reset_event(bool initially_set = false) noexcept
+            : m_state(initially_set ? set_state : 0) {}
+
+        async_auto_reset_event(const async_auto_reset_event&) = delete;
+        async_auto_reset_event&
+        operator=(const async_auto_reset_event&) = delete;
+
+        ~async_auto_reset_event() {
+            assert(m_state.load(std::memory_order_relaxed) == set_state ||
+                   m_state.load(std::memory_order_relaxed) == 0);
+            assert(m_waiters.empty());
+        }
+
+        // Resume a waiter here, if any.
+        void set() {
+            if (detail::async_waiter* w = take())
+                detail::resume_waiter(w);
+        }
+
+        // Like above, but the waiter is posted to the scheduler.
+        template<class Scheduler>
+        void set(Scheduler& sched) {
+            if (detail::async_waiter* w = take())
+                sched.post(w->m_coro);
+        }
+
+        // No effect if not set.
+        void reset() noexcept {
+            std::uintptr_t expected = set_state;
+            m_state.compare_exchange_strong(expected, 0,
+                                            std::memory_order_relaxed);
+        }
+
+        // Consume the set state if set.
+        bool try_wait() noexcept {
+            std::uintptr_t expected = set_state;
+            return m_state.compare_exchange_strong(expected, 0,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed);
+        }
+
+        struct [[nodiscard]] wait_awaiter : private detail::async_waiter {
+            bool await_ready() noexcept { return m_event->try_wait(); }
+
+            bool await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                return m_event->enqueue(this);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_event->cancel(this); }
+
+        private:
+            friend async_auto_reset_event;
+
+            explicit wait_awaiter(async_auto_reset_event* event) noexcept
+                : m_event(event) {}
+
+            async_auto_reset_event* m_event;
+        };
+
+        wait_awaiter wait() noexcept { return wait_awaiter(this); }
+
+    private:
+        static constexpr std::uintptr_t set_state = 1;
+
+        // Returns false if the set state is consumed instead.
+        bool enqueue(detail::async_waiter* w) noexcept {
+            std::uintptr_t state = m_state.load(std::memory_order_relaxed);
+            for (;;) {
+                if (state == set_state) {
+                    if (m_state.compare_exchange_weak(
+                            state, 0, std::memory_order_acquire,
+                            std::memory_order_relaxed))
+                        return false;
+                } else {
+                    w->m_next = reinterpret_cast<detail::async_waiter*>(state);
+                    if (m_state.compare_exchange_weak(
+                            state, reinterpret_cast<std::uintptr_t>(w),
+                            std::memory_order_release,
+                            std::memory_order_relaxed))
+                        return true;
+                }
+            }
+        }
+
+        // The waiter leaves, or passes the set state on to the next one if
+        // it was taken by 'set' but not resumed yet.
+        void cancel(detail::async_waiter* w) noexcept {
+            {
+                std::lock_guard guard(m_spin);
+                if (m_waiters.erase(w))
+                    return;
+                // It may still be in the stack, which is moved to the FIFO
+                // behind the older waiters.
+                std::uintptr_t state = m_state.load(std::memory_order_relaxed);
+                while (state != 0 && state != set_state) {
+                    if (m_state.compare_exchange_weak(
+                            state, 0, std::memory_order_acquire,
+                            std::memory_order_relaxed)) {
+                        auto list = detail::waiter_list::from_stack(
+                            reinterpret_cast<detail::async_waiter*>(state));
+                        m_waiters.splice_back(list);
+                        if (m_waiters.erase(w))
+                            return;
+                        break;
+                    }
+                }
+            }
+            if (detail::withdraw_released(w))
+                set();
+        }
+
+        // Take the next waiter, or become set if none. The state only becomes
+        // set when no waiter is left anywhere.
+        detail::async_waiter* take() noexcept {
+            std::lock_guard guard(m_spin);
+            if (m_waiters.empty()) {
+                std::uintptr_t state = m_state.load(std::memory_order_relaxed);
+                for (;;) {
+                    if (state == set_state)
+                        return nullptr;
+                    if (state == 0) {
+                        if (m_state.compare_exchange_weak(
+                                state, set_state, std::memory_order_release,
+                                std::memory_order_relaxed))
+                            return nullptr;
+                    } else if (m_state.compare_exchange_weak(
+                                   state, 0, std::memory_order_acquire,
+                                   std::memory_order_relaxed)) {
+                        m_waiters = detail::waiter_list::from_stack(
+                            reinterpret_cast<detail::async_waiter*>(state));
+                        break;
+                    }
+                }
+            }
+            return m_waiters.pop_front();
+        }
+
+        std::atomic<std::uintptr_t> m_state;
+        detail::spin_lock m_spin;
+        // The waiters taken from the stack, only accessed by the setters.
+        detail::waiter_list m_waiters;
+    };
+} // namespace coz
+
+#endif
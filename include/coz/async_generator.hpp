@@ -0,0 +1,217 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_GENERATOR_HPP
+#define COZ_ASYNC_GENERATOR_HPP
+
+#include <new>
+#include <cstddef>
+#include <utility>
+#include <coz/generator.hpp>
+
+namespace coz {
+    // Like 'generator_promise', but the body may await between the yields,
+    // and each yield resumes the consumer via symmetric transfer.
+    template<class T, class Policy = by_value>
+    struct async_generator_promise
+        : private detail::generator_storage<T, Policy> {
+        explicit async_generator_promise(
+            default_init<async_generator_promise>) noexcept {}
+
+        // Only valid before started.
+        async_generator_promise(async_generator_promise&&) noexcept {}
+
+        // Resume the consumer, which sees the end.
+        coroutine_handle<> finalize() noexcept {
+            this->m_ptr = nullptr;
+            return m_cont;
+        }
+
+        template<class U = T>
+            requires std::is_same_v<Policy, by_value>
+        void yield_value(U&& u) {
+            this->put(std::forward<U>(u));
+            detail::transfer_to(m_cont);
+        }
+
+        void yield_value(T& t) noexcept
+            requires std::is_same_v<Policy, by_reference>
+        {
+            this->put(std::addressof(t));
+            detail::transfer_to(m_cont);
+        }
+
+        // A temporary would be gone before the consumer sees it, it can be
+        // kept in the frame via COZ_YIELD_KEEP instead.
+        template<class U>
+            requires std::is_same_v<Policy, by_reference> &&
+                     (!std::is_lvalue_reference_v<U>)
+        void yield_value(U&&) = delete;
+
+        void yield_value(T* p) noexcept
+            requires std::is_same_v<Policy, by_pointer>
+        {
+            this->put(p);
+            detail::transfer_to(m_cont);
+        }
+
+        void return_void() noexcept {}
+
+#if !defined(COZ_NO_EXCEPTIONS)
+        void unhandled_exception() noexcept {
+            m_exception = std::current_exception();
+        }
+#endif
+
+    private:
+        template<class T2, class Policy2, class Params, class State>
+        friend struct async_generator_range;
+
+        // Release the current element, if any.
+        void release() noexcept {
+            if (this->m_ptr) {
+                this->drop();
+                this->m_ptr = nullptr;
+            }
+        }
+
+        T* current() {
+#if !defined(COZ_NO_EXCEPTIONS)
+            if (m_exception)
+                std::rethrow_exception(std::move(m_exception));
+#endif
+            return this->m_ptr;
+        }
+
+        coroutine_handle<> m_cont;
+#if !defined(COZ_NO_EXCEPTIONS)
+        std::exception_ptr m_exception;
+#endif
+    };
+
+    // Consumed by COZ_FOR_AWAIT, or by awaiting 'next' in a loop.
+    template<class T, class Policy, class Params, class State>
+    struct [[nodiscard]] async_generator_range {
+        using promise_type = async_generator_promise<T, Policy>;
+
+        explicit async_generator_range(Params&& params)
+            : m_coro(default_init<promise_type>{}),
+              m_params(std::move(params)) {}
+
+        // Only valid before started.
+        async_generator_range(async_generator_range&&) = default;
+        async_generator_range&
+        operator=(async_generator_range&&) = default;
+
+        // The generator may be suspended on an awaiter, which is cancelled.
+        ~async_generator_range() {
+            if (!m_coro.done()) {
+                auto& p = m_coro.promise();
+                p.m_cont = nullptr;
+                p.release();
+                m_coro.destroy();
+            }
+        }
+
+        struct next_awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            coroutine_handle<> await_suspend(coroutine_handle<> cont) {
+                auto& coro = m_self->m_coro;
+                auto& p = coro.promise();
+                p.m_cont = cont;
+                if (coro.done()) {
+                    coro.prepare(std::move(m_self->m_params));
+                } else {
+                    p.release();
+                }
+                return coro.handle();
+            }
+
+            // The next element, or null at the end.
+            T* await_resume() { return m_self->m_coro.promise().current(); }
+
+            async_generator_range* m_self;
+        };
+
+        // Await the next element, the first call starts the generator. Must
+        // not be called after the end.
+        next_awaiter next() noexcept { return {this}; }
+
+    private:
+        coroutine<promise_type, Params, State> m_coro;
+        Params m_params;
+    };
+
+    template<class T, class Policy = by_value>
+    constexpr default_init<async_generator_promise<T, Policy>>
+        async_generator{};
+
+    template<class T, class Policy, class Params, class State>
+    struct co_result<default_init<async_generator_promise<T, Policy>>, Params,
+                     State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<async_generator_promise<T, Policy>>
+            m_init;
+        Params m_params;
+
+        async_generator_range<T, Policy, Params, State> get_return_object() {
+            return async_generator_range<T, Policy, Params, State>(
+                std::move(m_params));
+        }
+    };
+} // namespace coz
+
+namespace coz::detail {
+    // The generator of COZ_FOR_AWAIT, constructed in the scoped locals.
+    template<class G>
+    struct for_await_slot {
+        for_await_slot() noexcept {}
+
+        for_await_slot(const for_await_slot&) = delete;
+        for_await_slot& operator=(const for_await_slot&) = delete;
+
+        ~for_await_slot() {
+            if (m_gen)
+                m_gen->~G();
+        }
+
+        G* m_gen = nullptr;
+        decltype(std::declval<G&>().next().await_resume()) m_elem = nullptr;
+        // Set while the body runs, so it's left set by `break`.
+        bool m_break = false;
+        alignas(G) std::byte m_data[sizeof(G)];
+    };
+} // namespace coz::detail
+
+// The element is awaited into the outer scope, and the body runs in the inner
+// scope, so `decl` is rebound after each suspension in the body.
+#define z_COZ_FOR_AWAIT(decl, expr, name, body, label)                         \
+    COZ_SCOPE(name, _coz_::for_await_slot<decltype(expr)> _coz_for;)           \
+    if (name._coz_for.m_gen = new (name._coz_for.m_data) decltype(expr)(expr); \
+        false) {                                                               \
+    } else                                                                     \
+        while (!name._coz_for.m_break)                                         \
+            z_COZ_AWAIT_LET(name._coz_for.m_elem,                              \
+                            name._coz_for.m_gen->next(), label)                \
+    if (!name._coz_for.m_elem)                                                 \
+        break;                                                                 \
+    else                                                                       \
+        z_COZ_SCOPE(body, )                                                    \
+    if (decl = *name._coz_for.m_elem; false) {                                 \
+    } else                                                                     \
+        switch (_coz_pc->m_next)                                               \
+        case 0:                                                                \
+            for (name._coz_for.m_break = true; name._coz_for.m_break;          \
+                 name._coz_for.m_break = false)
+
+// Loop over the elements of an async generator. `expr` must be the call that
+// returns it, and `decl` binds to each element, e.g. `const T& v`.
+#define COZ_FOR_AWAIT(decl, expr)                                              \
+    z_COZ_FOR_AWAIT(decl, expr, BOOST_PP_CAT(_coz_for, __LINE__),              \
+                    BOOST_PP_CAT(_coz_for_body, __LINE__),                     \
+                    BOOST_PP_CAT(_coz_for_L, __LINE__))
+
+#endif
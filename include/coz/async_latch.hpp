@@ -0,0 +1,121 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_LATCH_HPP
+#define COZ_ASYNC_LATCH_HPP
+
+#include <atomic>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <coz/async_waiter.hpp>
+
+namespace coz {
+    // Single-use countdown, like std::latch, whose waiters suspend. The
+    // waiters are pushed lock-free to a single atomic word, which is
+    // replaced by 'released' when the count reaches 0.
+    //
+    // A coroutine must not be destroyed while waiting on it.
+    struct async_latch {
+        explicit async_latch(std::ptrdiff_t expected) noexcept
+            : m_count(expected) {
+            assert(expected >= 0);
+            if (expected == 0)
+                m_waiters.store(released, std::memory_order_relaxed);
+        }
+
+        async_latch(const async_latch&) = delete;
+        async_latch& operator=(const async_latch&) = delete;
+
+        ~async_latch() {
+            assert(m_waiters.load(std::memory_order_relaxed) == released ||
+                   m_waiters.load(std::memory_order_relaxed) == 0);
+        }
+
+        // Resume the waiters here when the count reaches 0.
+        void count_down(std::ptrdiff_t n = 1) {
+            if (arrive(n))
+                detail::resume_waiters(take());
+        }
+
+        // Like above, but the waiters are posted to the scheduler in batches,
+        // e.g. a 'thread_pool', so the last thread doesn't run them.
+        template<class Scheduler>
+        void count_down(Scheduler& sched, std::ptrdiff_t n = 1) {
+            if (arrive(n))
+                detail::post_waiters(sched, take());
+        }
+
+        bool try_wait() const noexcept {
+            return m_waiters.load(std::memory_order_acquire) == released;
+        }
+
+        struct [[nodiscard]] wait_awaiter : private detail::async_waiter {
+            bool await_ready() const noexcept { return m_latch->try_wait(); }
+
+            bool await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                return m_latch->enqueue(this);
+            }
+
+            void await_resume() const noexcept {}
+
+        private:
+            friend async_latch;
+
+            explicit wait_awaiter(async_latch* latch) noexcept
+                : m_latch(latch) {}
+
+            async_latch* m_latch;
+        };
+
+        wait_awaiter wait() noexcept { return wait_awaiter(this); }
+
+        // Count down and wait.
+        wait_awaiter arrive_and_wait(std::ptrdiff_t n = 1) {
+            count_down(n);
+            return wait_awaiter(this);
+        }
+
+    private:
+        static constexpr std::uintptr_t released = 1;
+
+        // Returns true if the count reaches 0.
+        bool arrive(std::ptrdiff_t n) noexcept {
+            assert(n >= 0);
+            const std::ptrdiff_t prev =
+                m_count.fetch_sub(n, std::memory_order_acq_rel);
+            assert(prev >= n);
+            return n != 0 && prev == n;
+        }
+
+        // Returns false if it's released instead.
+        bool enqueue(detail::async_waiter* w) noexcept {
+            std::uintptr_t state = m_waiters.load(std::memory_order_acquire);
+            do {
+                if (state == released)
+                    return false;
+                w->m_next = reinterpret_cast<detail::async_waiter*>(state);
+            } while (!m_waiters.compare_exchange_weak(
+                state, reinterpret_cast<std::uintptr_t>(w),
+                std::memory_order_release, std::memory_order_acquire));
+            return true;
+        }
+
+        // Release it, and take the waiters in FIFO order.
+        detail::waiter_list take() noexcept {
+            return detail::waiter_list::from_stack(
+                reinterpret_cast<detail::async_waiter*>(
+                    m_waiters.exchange(released, std::memory_order_acq_rel)));
+        }
+
+        std::atomic<std::ptrdiff_t> m_count;
+        // The stack of the waiters, or 'released'.
+        std::atomic<std::uintptr_t> m_waiters{0};
+    };
+} // namespace coz
+
+#endif
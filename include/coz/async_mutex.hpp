@@ -0,0 +1,362 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_MUTEX_HPP
+#define COZ_ASYNC_MUTEX_HPP
+
+#include <mutex>
+#include <atomic>
+#include <cstdint>
+#include <cassert>
+#include <utility>
+#include <coz/async_waiter.hpp>
+
+namespace coz {
+    struct async_condition_variable;
+
+    // Owns the lock of a mutex and unlocks it on destruction, like
+    // std::unique_lock.
+    template<class Mutex, void (Mutex::*Unlock)()>
+    struct basic_async_lock {
+        basic_async_lock() noexcept = default;
+
+        basic_async_lock(Mutex& m, std::adopt_lock_t) noexcept : m_mutex(&m) {}
+
+        basic_async_lock(basic_async_lock&& other) noexcept
+            : m_mutex(std::exchange(other.m_mutex, nullptr)) {}
+
+        basic_async_lock& operator=(basic_async_lock&& other) noexcept {
+            if (this != &other) {
+                if (m_mutex)
+                    (m_mutex->*Unlock)();
+                m_mutex = std::exchange(other.m_mutex, nullptr);
+            }
+            return *this;
+        }
+
+        ~basic_async_lock() {
+            if (m_mutex)
+                (m_mutex->*Unlock)();
+        }
+
+        bool owns_lock() const noexcept { return m_mutex != nullptr; }
+
+        Mutex* mutex() const noexcept { return m_mutex; }
+
+        explicit operator bool() const noexcept { return owns_lock(); }
+
+        void unlock() { (std::exchange(m_mutex, nullptr)->*Unlock)(); }
+
+        // Give up the ownership without unlocking.
+        Mutex* release() noexcept { return std::exchange(m_mutex, nullptr); }
+
+    private:
+        Mutex* m_mutex = nullptr;
+    };
+
+    // Mutex that suspends the coroutine instead of blocking the thread. The
+    // lock word is a single atomic, which is either 'not_locked', 'locked'
+    // or the head of the stack of the newly arrived waiters. The waiters are
+    // linked through their awaiters, so it never allocates, and the lock is
+    // handed off to them in FIFO order.
+    //
+    // A coroutine must not be destroyed while waiting for the lock.
+    struct async_mutex {
+        async_mutex() noexcept = default;
+
+        async_mutex(const async_mutex&) = delete;
+        async_mutex& operator=(const async_mutex&) = delete;
+
+        ~async_mutex() {
+            assert(m_state.load(std::memory_order_relaxed) == not_locked ||
+                   m_state.load(std::memory_order_relaxed) == locked);
+            assert(m_waiters == nullptr);
+        }
+
+        bool try_lock() noexcept {
+            std::uintptr_t expected = not_locked;
+            return m_state.compare_exchange_strong(expected, locked,
+                                                   std::memory_order_acquire,
+                                                   std::memory_order_relaxed);
+        }
+
+        struct [[nodiscard]] lock_awaiter : private detail::async_waiter {
+            bool await_ready() noexcept { return m_mutex->try_lock(); }
+
+            bool await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                return m_mutex->enqueue(this);
+            }
+
+            void await_resume() const noexcept {}
+
+        protected:
+            friend async_mutex;
+
+            explicit lock_awaiter(async_mutex* m) noexcept : m_mutex(m) {}
+
+            async_mutex* m_mutex;
+        };
+
+        struct [[nodiscard]] scoped_lock_awaiter : lock_awaiter {
+            using lock_awaiter::lock_awaiter;
+
+            auto await_resume() const noexcept {
+                return basic_async_lock<async_mutex, &async_mutex::unlock>(
+                    *m_mutex, std::adopt_lock);
+            }
+        };
+
+        // The caller has to unlock it.
+        lock_awaiter lock() noexcept { return lock_awaiter(this); }
+
+        // The result owns the lock.
+        scoped_lock_awaiter scoped_lock() noexcept {
+            return scoped_lock_awaiter(this);
+        }
+
+        // Hand the lock to the next waiter and resume it, if any.
+        void unlock() {
+            assert(m_state.load(std::memory_order_relaxed) != not_locked);
+            detail::async_waiter* head = m_waiters;
+            if (!head) {
+                std::uintptr_t expected = locked;
+                if (m_state.compare_exchange_strong(expected, not_locked,
+                                                    std::memory_order_release,
+                                                    std::memory_order_relaxed))
+                    return;
+                // Take the new waiters.
+                head = detail::waiter_list::from_stack(
+                           reinterpret_cast<detail::async_waiter*>(
+                               m_state.exchange(locked,
+                                                std::memory_order_acquire)))
+                           .front();
+            }
+            m_waiters = head->m_next;
+            detail::resume_waiter(head);
+        }
+
+    private:
+        friend async_condition_variable;
+
+        static constexpr std::uintptr_t not_locked = 1;
+        static constexpr std::uintptr_t locked = 0;
+
+        // Returns false if the lock is acquired instead.
+        bool enqueue(detail::async_waiter* w) noexcept {
+            std::uintptr_t state = m_state.load(std::memory_order_relaxed);
+            for (;;) {
+                if (state == not_locked) {
+                    if (m_state.compare_exchange_weak(
+                            state, locked, std::memory_order_acquire,
+                            std::memory_order_relaxed))
+                        return false;
+                } else {
+                    w->m_next = reinterpret_cast<detail::async_waiter*>(state);
+                    if (m_state.compare_exchange_weak(
+                            state, reinterpret_cast<std::uintptr_t>(w),
+                            std::memory_order_release,
+                            std::memory_order_relaxed))
+                        return true;
+                }
+            }
+        }
+
+        std::atomic<std::uintptr_t> m_state{not_locked};
+        // The waiters in FIFO order, only accessed by the owner.
+        detail::async_waiter* m_waiters = nullptr;
+    };
+
+    using async_mutex_lock =
+        basic_async_lock<async_mutex, &async_mutex::unlock>;
+
+    // Reader-writer lock. The waiters are served in FIFO order, so a reader
+    // that arrives after a waiting writer waits too, and the consecutive
+    // readers are resumed together. The state is guarded by a spin lock,
+    // which is never held while resuming.
+    struct async_shared_mutex {
+        async_shared_mutex() noexcept = default;
+
+        async_shared_mutex(const async_shared_mutex&) = delete;
+        async_shared_mutex& operator=(const async_shared_mutex&) = delete;
+
+        ~async_shared_mutex() { assert(m_waiters.empty()); }
+
+        bool try_lock() noexcept {
+            std::lock_guard guard(m_spin);
+            if (m_state != 0 || !m_waiters.empty())
+                return false;
+            m_state = writer;
+            return true;
+        }
+
+        bool try_lock_shared() noexcept {
+            std::lock_guard guard(m_spin);
+            if (m_state == writer || !m_waiters.empty())
+                return false;
+            ++m_state;
+            return true;
+        }
+
+    private:
+        struct waiter : detail::async_waiter {
+            bool m_shared;
+        };
+
+    public:
+        template<bool Shared>
+        struct [[nodiscard]] lock_awaiter : private waiter {
+            bool await_ready() noexcept {
+                return Shared ? m_mutex->try_lock_shared()
+                              : m_mutex->try_lock();
+            }
+
+            bool await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                m_shared = Shared;
+                return m_mutex->enqueue(this);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_mutex->cancel(this); }
+
+        protected:
+            friend async_shared_mutex;
+
+            explicit lock_awaiter(async_shared_mutex* m) noexcept
+                : m_mutex(m) {}
+
+            async_shared_mutex* m_mutex;
+        };
+
+        template<bool Shared>
+        struct [[nodiscard]] scoped_lock_awaiter : lock_awaiter<Shared> {
+            using lock_awaiter<Shared>::lock_awaiter;
+
+            auto await_resume() const noexcept {
+                if constexpr (Shared) {
+                    return basic_async_lock<
+                        async_shared_mutex, &async_shared_mutex::unlock_shared>(
+                        *this->m_mutex, std::adopt_lock);
+                } else {
+                    return basic_async_lock<async_shared_mutex,
+                                            &async_shared_mutex::unlock>(
+                        *this->m_mutex, std::adopt_lock);
+                }
+            }
+        };
+
+        lock_awaiter<false> lock() noexcept {
+            return lock_awaiter<false>(this);
+        }
+
+        lock_awaiter<true> lock_shared() noexcept {
+            return lock_awaiter<true>(this);
+        }
+
+        scoped_lock_awaiter<false> scoped_lock() noexcept {
+            return scoped_lock_awaiter<false>(this);
+        }
+
+        scoped_lock_awaiter<true> scoped_lock_shared() noexcept {
+            return scoped_lock_awaiter<true>(this);
+        }
+
+        void unlock() {
+            detail::waiter_list ready;
+            {
+                std::lock_guard guard(m_spin);
+                assert(m_state == writer);
+                m_state = 0;
+                admit(ready);
+            }
+            detail::resume_waiters(ready);
+        }
+
+        void unlock_shared() {
+            detail::waiter_list ready;
+            {
+                std::lock_guard guard(m_spin);
+                assert(m_state > 0);
+                if (--m_state == 0)
+                    admit(ready);
+            }
+            detail::resume_waiters(ready);
+        }
+
+    private:
+        static constexpr std::intptr_t writer = -1;
+
+        static bool is_shared(detail::async_waiter* w) noexcept {
+            return static_cast<waiter*>(w)->m_shared;
+        }
+
+        // Returns false if the lock is acquired instead.
+        bool enqueue(waiter* w) noexcept {
+            std::lock_guard guard(m_spin);
+            if (m_waiters.empty()) {
+                if (w->m_shared && m_state != writer) {
+                    ++m_state;
+                    return false;
+                }
+                if (!w->m_shared && m_state == 0) {
+                    m_state = writer;
+                    return false;
+                }
+            }
+            m_waiters.push_back(w);
+            return true;
+        }
+
+        // The waiter leaves the queue, or gives back the lock if it was
+        // handed to it but not resumed yet. The readers behind a cancelled
+        // writer are admitted by the next unlock.
+        void cancel(waiter* w) noexcept {
+            {
+                std::lock_guard guard(m_spin);
+                if (m_waiters.erase(w))
+                    return;
+            }
+            if (detail::withdraw_released(w)) {
+                if (w->m_shared) {
+                    unlock_shared();
+                } else {
+                    unlock();
+                }
+            }
+        }
+
+        // The lock is free, hand it to the next writer or to the readers at
+        // the front.
+        void admit(detail::waiter_list& ready) noexcept {
+            if (m_waiters.empty())
+                return;
+            if (!is_shared(m_waiters.front())) {
+                m_state = writer;
+                ready.push_back(m_waiters.pop_front());
+                return;
+            }
+            while (!m_waiters.empty() && is_shared(m_waiters.front())) {
+                ++m_state;
+                ready.push_back(m_waiters.pop_front());
+            }
+        }
+
+        detail::spin_lock m_spin;
+        // The number of readers, or 'writer'.
+        std::intptr_t m_state = 0;
+        detail::waiter_list m_waiters;
+    };
+
+    using async_shared_mutex_lock =
+        basic_async_lock<async_shared_mutex, &async_shared_mutex::unlock>;
+    using async_shared_lock =
+        basic_async_lock<async_shared_mutex,
+                         &async_shared_mutex::unlock_shared>;
+} // namespace coz
+
+#endif
@@ -0,0 +1,125 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_SEMAPHORE_HPP
+#define COZ_ASYNC_SEMAPHORE_HPP
+
+#include <mutex>
+#include <atomic>
+#include <cstddef>
+#include <cassert>
+#include <coz/async_waiter.hpp>
+
+namespace coz {
+    // Counting semaphore that suspends the coroutine instead of blocking the
+    // thread, e.g. to bound the number of operations in flight. Acquiring an
+    // available unit is lock-free, the waiters are queued in FIFO order
+    // under a spin lock, and linked through their awaiters.
+    struct async_semaphore {
+        explicit async_semaphore(std::ptrdiff_t initial) noexcept
+            : m_count(initial) {
+            assert(initial >= 0);
+        }
+
+        async_semaphore(const async_semaphore&) = delete;
+        async_semaphore& operator=(const async_semaphore&) = delete;
+
+        ~async_semaphore() { assert(m_waiters.empty()); }
+
+        bool try_acquire() noexcept {
+            std::ptrdiff_t count = m_count.load(std::memory_order_relaxed);
+            while (count > 0) {
+                if (m_count.compare_exchange_weak(count, count - 1,
+                                                  std::memory_order_acquire,
+                                                  std::memory_order_relaxed))
+                    return true;
+            }
+            return false;
+        }
+
+        struct [[nodiscard]] acquire_awaiter : private detail::async_waiter {
+            bool await_ready() noexcept { return m_sem->try_acquire(); }
+
+            bool await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                return m_sem->enqueue(this);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_sem->cancel(this); }
+
+        private:
+            friend async_semaphore;
+
+            explicit acquire_awaiter(async_semaphore* sem) noexcept
+                : m_sem(sem) {}
+
+            async_semaphore* m_sem;
+        };
+
+        acquire_awaiter acquire() noexcept { return acquire_awaiter(this); }
+
+        // Hand the units to the waiters and resume them here, the rest
+        // become available.
+        void release(std::ptrdiff_t n = 1) {
+            detail::resume_waiters(grant(n));
+        }
+
+        // Like above, but the waiters are posted to the scheduler in batches,
+        // e.g. a 'thread_pool', so the releasing thread doesn't run them.
+        template<class Scheduler>
+        void release(Scheduler& sched, std::ptrdiff_t n = 1) {
+            detail::post_waiters(sched, grant(n));
+        }
+
+        // The number of available units, which is 0 if any is waiting.
+        std::ptrdiff_t available() const noexcept {
+            return m_count.load(std::memory_order_relaxed);
+        }
+
+    private:
+        // Returns false if a unit is acquired instead. A unit only becomes
+        // available under the lock when none is waiting, so a waiter can't
+        // miss it.
+        bool enqueue(detail::async_waiter* w) noexcept {
+            std::lock_guard guard(m_spin);
+            if (try_acquire())
+                return false;
+            m_waiters.push_back(w);
+            return true;
+        }
+
+        // The waiter leaves the queue, or gives back the unit if it was
+        // granted but not resumed yet.
+        void cancel(detail::async_waiter* w) noexcept {
+            {
+                std::lock_guard guard(m_spin);
+                if (m_waiters.erase(w))
+                    return;
+            }
+            if (detail::withdraw_released(w))
+                release();
+        }
+
+        detail::waiter_list grant(std::ptrdiff_t n) noexcept {
+            assert(n >= 0);
+            detail::waiter_list granted;
+            std::lock_guard guard(m_spin);
+            for (; n != 0 && !m_waiters.empty(); --n)
+                granted.push_back(m_waiters.pop_front());
+            if (n != 0)
+                m_count.fetch_add(n, std::memory_order_release);
+            return granted;
+        }
+
+        std::atomic<std::ptrdiff_t> m_count;
+        detail::spin_lock m_spin;
+        detail::waiter_list m_waiters;
+    };
+} // namespace coz
+
+#endif
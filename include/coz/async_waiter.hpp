@@ -0,0 +1,170 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_ASYNC_WAITER_HPP
+#define COZ_ASYNC_WAITER_HPP
+
+#include <atomic>
+#include <thread>
+#include <cstddef>
+#include <utility>
+#include <coz/coroutine.hpp>
+
+// The building blocks of the synchronization primitives.
+namespace coz::detail {
+    // A coroutine waiting on a primitive, which lives in its awaiter.
+    struct async_waiter {
+        coroutine_handle<> m_coro;
+        async_waiter* m_next = nullptr;
+    };
+
+    // FIFO of waiters, linked through the awaiters.
+    struct waiter_list {
+        bool empty() const noexcept { return m_head == nullptr; }
+
+        async_waiter* front() const noexcept { return m_head; }
+
+        void push_back(async_waiter* w) noexcept {
+            w->m_next = nullptr;
+            if (m_tail) {
+                m_tail->m_next = w;
+            } else {
+                m_head = w;
+            }
+            m_tail = w;
+        }
+
+        async_waiter* pop_front() noexcept {
+            async_waiter* w = m_head;
+            m_head = std::exchange(w->m_next, nullptr);
+            if (!m_head)
+                m_tail = nullptr;
+            return w;
+        }
+
+        void splice_back(waiter_list& other) noexcept {
+            if (other.empty())
+                return;
+            if (m_tail) {
+                m_tail->m_next = other.m_head;
+            } else {
+                m_head = other.m_head;
+            }
+            m_tail = other.m_tail;
+            other.m_head = other.m_tail = nullptr;
+        }
+
+        // The waiters pushed to a lock-free stack, in the order of pushing.
+        static waiter_list from_stack(async_waiter* top) noexcept {
+            waiter_list list;
+            list.m_tail = top;
+            while (top) {
+                async_waiter* next = top->m_next;
+                top->m_next = list.m_head;
+                list.m_head = top;
+                top = next;
+            }
+            return list;
+        }
+
+        // Returns false if not found, O(n).
+        bool erase(async_waiter* w) noexcept {
+            async_waiter* prev = nullptr;
+            for (async_waiter* it = m_head; it; prev = it, it = it->m_next) {
+                if (it == w) {
+                    (prev ? prev->m_next : m_head) = w->m_next;
+                    if (m_tail == w)
+                        m_tail = prev;
+                    w->m_next = nullptr;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+        async_waiter* m_head = nullptr;
+        async_waiter* m_tail = nullptr;
+    };
+
+    // The waiters being resumed by the outermost 'resume_waiters' of the
+    // thread.
+    inline thread_local waiter_list t_resume_list;
+    inline thread_local bool t_resuming = false;
+
+    // Resume the waiters in order. When a resumed coroutine releases a
+    // primitive in turn, the waiters are queued and resumed by the outermost
+    // call, so that a chain of handoffs doesn't nest on the stack.
+    inline void resume_waiters(waiter_list list) {
+        t_resume_list.splice_back(list);
+        if (t_resuming)
+            return;
+        struct reset {
+            ~reset() { t_resuming = false; }
+        } guard;
+        t_resuming = true;
+        while (!t_resume_list.empty())
+            t_resume_list.pop_front()->m_coro.resume();
+    }
+
+    // Withdraw a waiter that was released to the 'resume_waiters' of this
+    // thread but not resumed yet, e.g. destroyed by one resumed before it.
+    inline bool withdraw_released(async_waiter* w) noexcept {
+        return t_resume_list.erase(w);
+    }
+
+    inline void resume_waiter(async_waiter* w) {
+        waiter_list list;
+        list.push_back(w);
+        resume_waiters(list);
+    }
+
+    // Hand the waiters to a scheduler, which has `post(coroutine_handle<>)`
+    // like 'thread_pool', instead of resuming them here. If it also has
+    // `post_bulk(const coroutine_handle<>*, size_t)`, they're posted in
+    // batches.
+    template<class Scheduler>
+    void post_waiters(Scheduler& sched, waiter_list list) {
+        if constexpr (requires(const coroutine_handle<>* p) {
+                          sched.post_bulk(p, std::size_t());
+                      }) {
+            constexpr std::size_t batch_size = 32;
+            coroutine_handle<> batch[batch_size];
+            while (!list.empty()) {
+                std::size_t n = 0;
+                do {
+                    batch[n++] = list.pop_front()->m_coro;
+                } while (n != batch_size && !list.empty());
+                sched.post_bulk(batch, n);
+            }
+        } else {
+            while (!list.empty())
+                sched.post(list.pop_front()->m_coro);
+        }
+    }
+
+    // For the short critical sections of the primitives, which never resume
+    // a coroutine while held.
+    struct spin_lock {
+        void lock() noexcept {
+            while (m_locked.exchange(true, std::memory_order_acquire)) {
+                for (unsigned n = 0; m_locked.load(std::memory_order_relaxed);
+                     ++n) {
+                    if (n > 64)
+                        std::this_thread::yield();
+                }
+            }
+        }
+
+        void unlock() noexcept {
+            m_locked.store(false, std::memory_order_release);
+        }
+
+    private:
+        std::atomic<bool> m_locked{false};
+    };
+} // namespace coz::detail
+
+#endif
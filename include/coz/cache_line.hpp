@@ -0,0 +1,18 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_CACHE_LINE_HPP
+#define COZ_CACHE_LINE_HPP
+
+#include <cstddef>
+
+namespace coz::detail {
+    // The alignment of the data written by different threads, to avoid false
+    // sharing.
+    inline constexpr std::size_t cache_line = 64;
+} // namespace coz::detail
+
+#endif
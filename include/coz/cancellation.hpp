@@ -0,0 +1,64 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_CANCELLATION_HPP
+#define COZ_CANCELLATION_HPP
+
+#include <optional>
+#include <stop_token>
+#include <coz/coroutine.hpp>
+
+namespace coz {
+    // The stop token of the coroutine, which comes from
+    // 'Promise::get_stop_token' if defined.
+    template<class Promise>
+    std::stop_token get_stop_token(coroutine_handle<Promise> coro) noexcept {
+        if constexpr (requires { coro.promise().get_stop_token(); }) {
+            return coro.promise().get_stop_token();
+        } else {
+            return {};
+        }
+    }
+
+    // Base of the Promise that owns the stop state.
+    struct stoppable_promise {
+        std::stop_token get_stop_token() const noexcept {
+            return m_stop.get_token();
+        }
+
+        bool request_stop() noexcept { return m_stop.request_stop(); }
+
+        std::stop_source m_stop;
+    };
+
+    // Member of the Awaiter that calls F when stop is requested while the
+    // coroutine is suspended on it.
+    template<class F>
+    struct stop_slot {
+        // Returns false if stop has already been requested, in which case F
+        // is not registered and the awaiter shouldn't suspend. F may still be
+        // called inside, if stop is requested concurrently.
+        template<class Promise>
+        bool arm(coroutine_handle<Promise> coro, F f) {
+            auto token = get_stop_token(coro);
+            if (token.stop_requested())
+                return false;
+            if (token.stop_possible())
+                m_callback.emplace(std::move(token), std::move(f));
+            return true;
+        }
+
+        // Must be called before the coroutine is resumed, also by F itself,
+        // which then must not touch its own members afterwards. This waits for
+        // F if it's running on another thread.
+        void disarm() noexcept { m_callback.reset(); }
+
+    private:
+        std::optional<std::stop_callback<F>> m_callback;
+    };
+} // namespace coz
+
+#endif
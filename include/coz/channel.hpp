@@ -0,0 +1,377 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_CHANNEL_HPP
+#define COZ_CHANNEL_HPP
+
+#include <new>
+#include <mutex>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cassert>
+#include <type_traits>
+#include <coz/async_waiter.hpp>
+#include <coz/cache_line.hpp>
+
+namespace coz {
+    // Bounded MPMC channel. The buffer is a ring of N cells with a sequence
+    // number each, as described in "Bounded MPMC queue" (Vyukov), so that
+    // sending to a non-full channel and receiving from a non-empty one are
+    // lock-free and never suspend. Otherwise the coroutine waits in a FIFO
+    // under a spin lock, with its value in its awaiter: a sender that finds
+    // a waiting receiver hands the value over directly, and a receiver that
+    // takes a value from a full buffer refills it from the first waiting
+    // sender. The resumptions happen inline, like 'async_mutex'.
+    template<class T, std::size_t N>
+    struct channel {
+        static_assert(N >= 2 && (N & (N - 1)) == 0,
+                      "N must be a power of 2, at least 2");
+        static_assert(std::is_nothrow_move_constructible_v<T>);
+
+        channel() noexcept {
+            for (std::size_t i = 0; i != N; ++i)
+                m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+        }
+
+        channel(const channel&) = delete;
+        channel& operator=(const channel&) = delete;
+
+        // The values left in the buffer are destroyed.
+        ~channel() {
+            assert(m_senders.empty() && m_receivers.empty());
+            T* p;
+            while ((p = front()))
+                pop_front(p);
+        }
+
+        static constexpr std::size_t capacity() noexcept { return N; }
+
+        // Moves from 'value' only on success. Fails if someone is waiting,
+        // so that it doesn't overtake the waiting senders.
+        bool try_send(T& value) {
+            if (m_senders_waiting.load(std::memory_order_relaxed) != 0 ||
+                m_receivers_waiting.load(std::memory_order_relaxed) != 0 ||
+                !try_push(value))
+                return false;
+            // Pairs with the fence in 'wait_receive'.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_receivers_waiting.load(std::memory_order_relaxed) != 0)
+                feed_receivers();
+            return true;
+        }
+
+        bool try_receive(T& out) {
+            if (!try_pop(out))
+                return false;
+            after_receive();
+            return true;
+        }
+
+        struct [[nodiscard]] send_awaiter : private detail::async_waiter {
+            bool await_ready() { return m_chan->try_send(m_value); }
+
+            bool await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                return m_chan->wait_send(this);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_chan->cancel_send(this); }
+
+        private:
+            friend channel;
+
+            send_awaiter(channel* chan, T&& value) noexcept
+                : m_chan(chan), m_value(std::move(value)) {}
+
+            channel* m_chan;
+            T m_value;
+        };
+
+        struct [[nodiscard]] receive_awaiter : private detail::async_waiter {
+            receive_awaiter(const receive_awaiter&) = delete;
+            receive_awaiter& operator=(const receive_awaiter&) = delete;
+
+            ~receive_awaiter() {
+                if (m_has_value)
+                    std::destroy_at(value());
+            }
+
+            bool await_ready() {
+                if (!m_chan->try_pop_into(this))
+                    return false;
+                m_chan->after_receive();
+                return true;
+            }
+
+            bool await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                return m_chan->wait_receive(this);
+            }
+
+            T await_resume() noexcept { return std::move(*value()); }
+
+            void await_cancel() noexcept { m_chan->cancel_receive(this); }
+
+        private:
+            friend channel;
+
+            explicit receive_awaiter(channel* chan) noexcept : m_chan(chan) {}
+
+            T* value() noexcept {
+                return std::launder(reinterpret_cast<T*>(m_storage));
+            }
+
+            channel* m_chan;
+            bool m_has_value = false;
+            alignas(T) unsigned char m_storage[sizeof(T)];
+        };
+
+        send_awaiter send(T value) noexcept {
+            return {this, std::move(value)};
+        }
+
+        receive_awaiter receive() noexcept { return receive_awaiter(this); }
+
+    private:
+        struct cell {
+            std::atomic<std::size_t> m_seq;
+            alignas(T) unsigned char m_storage[sizeof(T)];
+        };
+
+        static T* value_of(cell& c) noexcept {
+            return std::launder(reinterpret_cast<T*>(c.m_storage));
+        }
+
+        bool try_push(T& value) noexcept {
+            std::size_t pos = m_tail.load(std::memory_order_relaxed);
+            cell* c;
+            for (;;) {
+                c = &m_cells[pos & (N - 1)];
+                const std::size_t seq =
+                    c->m_seq.load(std::memory_order_acquire);
+                const auto diff = std::ptrdiff_t(seq - pos);
+                if (diff == 0) {
+                    if (m_tail.compare_exchange_weak(pos, pos + 1,
+                                                     std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+            ::new (c->m_storage) T(std::move(value));
+            c->m_seq.store(pos + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Calls 'f' with the value of the front cell, which is then freed.
+        template<class F>
+        bool try_pop_with(F f) noexcept {
+            std::size_t pos = m_head.load(std::memory_order_relaxed);
+            cell* c;
+            for (;;) {
+                c = &m_cells[pos & (N - 1)];
+                const std::size_t seq =
+                    c->m_seq.load(std::memory_order_acquire);
+                const auto diff = std::ptrdiff_t(seq - (pos + 1));
+                if (diff == 0) {
+                    if (m_head.compare_exchange_weak(pos, pos + 1,
+                                                     std::memory_order_relaxed))
+                        break;
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_head.load(std::memory_order_relaxed);
+                }
+            }
+            T* p = value_of(*c);
+            f(*p);
+            std::destroy_at(p);
+            c->m_seq.store(pos + N, std::memory_order_release);
+            return true;
+        }
+
+        bool try_pop(T& out) noexcept {
+            return try_pop_with([&](T& v) { out = std::move(v); });
+        }
+
+        bool try_pop_into(receive_awaiter* r) noexcept {
+            return try_pop_with([r](T& v) {
+                ::new (r->m_storage) T(std::move(v));
+                r->m_has_value = true;
+            });
+        }
+
+        // The receivers may have freed a cell for a waiting sender.
+        void after_receive() {
+            // Pairs with the fence in 'wait_send'.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_senders_waiting.load(std::memory_order_relaxed) != 0)
+                drain_senders();
+        }
+
+        // Only used by the destructor, which has no concurrency.
+        T* front() noexcept {
+            const std::size_t pos = m_head.load(std::memory_order_relaxed);
+            cell& c = m_cells[pos & (N - 1)];
+            if (c.m_seq.load(std::memory_order_relaxed) != pos + 1)
+                return nullptr;
+            return value_of(c);
+        }
+
+        void pop_front(T* p) noexcept {
+            const std::size_t pos = m_head.load(std::memory_order_relaxed);
+            std::destroy_at(p);
+            m_cells[pos & (N - 1)].m_seq.store(pos + N,
+                                               std::memory_order_relaxed);
+            m_head.store(pos + 1, std::memory_order_relaxed);
+        }
+
+        static send_awaiter* as_sender(detail::async_waiter* w) noexcept {
+            return static_cast<send_awaiter*>(w);
+        }
+
+        static receive_awaiter* as_receiver(detail::async_waiter* w) noexcept {
+            return static_cast<receive_awaiter*>(w);
+        }
+
+        // Returns false if the value is delivered instead.
+        bool wait_send(send_awaiter* s) {
+            detail::waiter_list ready;
+            {
+                std::lock_guard guard(m_spin);
+                if (!m_receivers.empty()) {
+                    // Hand the value over directly.
+                    receive_awaiter* r = as_receiver(m_receivers.pop_front());
+                    m_receivers_waiting.fetch_sub(1, std::memory_order_relaxed);
+                    ::new (r->m_storage) T(std::move(s->m_value));
+                    r->m_has_value = true;
+                    ready.push_back(r);
+                } else {
+                    // Announce it before the last try, so that a concurrent
+                    // receiver either sees it or frees the cell for us.
+                    m_senders_waiting.fetch_add(1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!try_push(s->m_value)) {
+                        m_senders.push_back(s);
+                        return true;
+                    }
+                    m_senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+            detail::resume_waiters(ready);
+            return false;
+        }
+
+        // Returns false if a value is received instead.
+        bool wait_receive(receive_awaiter* r) {
+            detail::async_waiter* sender = nullptr;
+            {
+                std::lock_guard guard(m_spin);
+                // Announce it before the last try, so that a concurrent
+                // sender either sees it or fills the cell for us.
+                m_receivers_waiting.fetch_add(1, std::memory_order_relaxed);
+                std::atomic_thread_fence(std::memory_order_seq_cst);
+                if (!try_pop_into(r)) {
+                    if (m_senders.empty()) {
+                        m_receivers.push_back(r);
+                        return true;
+                    }
+                    // The buffer has been emptied before a concurrent
+                    // 'drain_senders' gets the lock, so the value of the
+                    // first sender is the oldest.
+                    sender = m_senders.pop_front();
+                    m_senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+                    ::new (r->m_storage)
+                        T(std::move(as_sender(sender)->m_value));
+                    r->m_has_value = true;
+                }
+                m_receivers_waiting.fetch_sub(1, std::memory_order_relaxed);
+            }
+            if (sender) {
+                detail::resume_waiter(sender);
+            } else {
+                after_receive();
+            }
+            return false;
+        }
+
+        // The sender leaves the queue with its value. If the value was taken
+        // but the sender wasn't resumed yet, only the resumption is
+        // withdrawn.
+        void cancel_send(send_awaiter* s) noexcept {
+            {
+                std::lock_guard guard(m_spin);
+                if (m_senders.erase(s)) {
+                    m_senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+                    return;
+                }
+            }
+            detail::withdraw_released(s);
+        }
+
+        // The receiver leaves the queue. If a value was handed to it but it
+        // wasn't resumed yet, the value is destroyed with the awaiter.
+        void cancel_receive(receive_awaiter* r) noexcept {
+            {
+                std::lock_guard guard(m_spin);
+                if (m_receivers.erase(r)) {
+                    m_receivers_waiting.fetch_sub(1,
+                                                  std::memory_order_relaxed);
+                    return;
+                }
+            }
+            detail::withdraw_released(r);
+        }
+
+        // The buffer may have space, move the values of the waiting senders
+        // into it, and resume them.
+        void drain_senders() {
+            detail::waiter_list ready;
+            {
+                std::lock_guard guard(m_spin);
+                while (!m_senders.empty() &&
+                       try_push(as_sender(m_senders.front())->m_value)) {
+                    ready.push_back(m_senders.pop_front());
+                    m_senders_waiting.fetch_sub(1, std::memory_order_relaxed);
+                }
+            }
+            detail::resume_waiters(ready);
+        }
+
+        // The buffer may have values, move them to the waiting receivers, and
+        // resume them.
+        void feed_receivers() {
+            detail::waiter_list ready;
+            {
+                std::lock_guard guard(m_spin);
+                while (!m_receivers.empty() &&
+                       try_pop_into(as_receiver(m_receivers.front()))) {
+                    ready.push_back(m_receivers.pop_front());
+                    m_receivers_waiting.fetch_sub(1,
+                                                  std::memory_order_relaxed);
+                }
+            }
+            detail::resume_waiters(ready);
+        }
+
+        alignas(detail::cache_line) std::atomic<std::size_t> m_head{0};
+        alignas(detail::cache_line) std::atomic<std::size_t> m_tail{0};
+        alignas(detail::cache_line) std::atomic<int> m_senders_waiting{0};
+        std::atomic<int> m_receivers_waiting{0};
+        detail::spin_lock m_spin;
+        detail::waiter_list m_senders;
+        detail::waiter_list m_receivers;
+        cell m_cells[N];
+    };
+} // namespace coz
+
+#endif
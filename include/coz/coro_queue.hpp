@@ -0,0 +1,122 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_CORO_QUEUE_HPP
+#define COZ_CORO_QUEUE_HPP
+
+#include <utility>
+#include <cassert>
+#include <coz/coroutine.hpp>
+
+namespace coz {
+    // FIFO of suspended coroutines, linked through their frames, so it never
+    // allocates. Only coroutines whose Promise has the intrusive link can be
+    // pushed, and each can only be in one queue at a time. Not thread-safe.
+    struct coro_queue {
+        coro_queue() noexcept = default;
+
+        coro_queue(coro_queue&& other) noexcept
+            : m_head(std::exchange(other.m_head, nullptr)),
+              m_tail(std::exchange(other.m_tail, nullptr)) {}
+
+        coro_queue& operator=(coro_queue&& other) noexcept {
+            assert(empty());
+            m_head = std::exchange(other.m_head, nullptr);
+            m_tail = std::exchange(other.m_tail, nullptr);
+            return *this;
+        }
+
+        bool empty() const noexcept { return m_head == nullptr; }
+
+        coroutine_handle<> front() const noexcept {
+            return coroutine_handle<>::from_address(m_head);
+        }
+
+        template<class Promise>
+            requires has_intrusive_link_v<Promise>
+        void push_back(coroutine_handle<Promise> coro) noexcept {
+            detail::coro_proto* const p = proto_of(coro);
+            assert(detail::link_of(p)->m_next == nullptr);
+            if (m_tail) {
+                detail::link_of(m_tail)->m_next = p;
+            } else {
+                m_head = p;
+            }
+            m_tail = p;
+        }
+
+        template<class Promise>
+            requires has_intrusive_link_v<Promise>
+        void push_front(coroutine_handle<Promise> coro) noexcept {
+            detail::coro_proto* const p = proto_of(coro);
+            assert(detail::link_of(p)->m_next == nullptr);
+            detail::link_of(p)->m_next = m_head;
+            if (!m_head)
+                m_tail = p;
+            m_head = p;
+        }
+
+        // Requires !empty().
+        coroutine_handle<> pop_front() noexcept {
+            assert(m_head);
+            detail::coro_proto* p = m_head;
+            m_head = std::exchange(detail::link_of(p)->m_next, nullptr);
+            if (!m_head)
+                m_tail = nullptr;
+            return coroutine_handle<>::from_address(p);
+        }
+
+        // Move all the coroutines of 'other' to the back in O(1).
+        void splice_back(coro_queue& other) noexcept {
+            if (other.empty())
+                return;
+            if (m_tail) {
+                detail::link_of(m_tail)->m_next = other.m_head;
+            } else {
+                m_head = other.m_head;
+            }
+            m_tail = other.m_tail;
+            other.m_head = other.m_tail = nullptr;
+        }
+
+        // Remove the coroutine if it's in the queue, which is O(n), e.g. when
+        // a waiter is cancelled.
+        template<class Promise>
+            requires has_intrusive_link_v<Promise>
+        bool erase(coroutine_handle<Promise> coro) noexcept {
+            detail::coro_proto* const p = proto_of(coro);
+            detail::coro_proto* prev = nullptr;
+            for (detail::coro_proto* it = m_head; it;
+                 prev = it, it = detail::link_of(it)->m_next) {
+                if (it == p) {
+                    detail::coro_proto* next =
+                        std::exchange(detail::link_of(p)->m_next, nullptr);
+                    if (prev) {
+                        detail::link_of(prev)->m_next = next;
+                    } else {
+                        m_head = next;
+                    }
+                    if (m_tail == p)
+                        m_tail = prev;
+                    return true;
+                }
+            }
+            return false;
+        }
+
+    private:
+        template<class Promise>
+        static detail::coro_proto*
+        proto_of(coroutine_handle<Promise> coro) noexcept {
+            return static_cast<detail::coro_proto*>(coro.address());
+        }
+
+        detail::coro_proto* m_head = nullptr;
+        detail::coro_proto* m_tail = nullptr;
+    };
+} // namespace coz
+
+#endif
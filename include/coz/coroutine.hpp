@@ -7,9 +7,12 @@
 #ifndef COZ_COROUTINE_HPP
 #define COZ_COROUTINE_HPP
 
+#include <bit>
 #include <utility>
 #include <cstdint>
+#include <type_traits>
 #include <cassert>
+#include <cstring>
 #include <exception>
 #include <algorithm>
 #include <boost/config.hpp>
@@ -23,6 +26,37 @@
 #define COZ_NO_UNIQUE_ADDRESS [[no_unique_address]]
 #endif
 
+#if defined(BOOST_NO_EXCEPTIONS) && !defined(COZ_NO_EXCEPTIONS)
+#define COZ_NO_EXCEPTIONS
+#endif
+
+namespace coz {
+    // Whether the object can be moved to another address by copying its
+    // bytes. Either specialize it or define a member type named
+    // 'coz_trivially_relocatable'.
+    template<class T>
+    struct is_trivially_relocatable
+        : std::bool_constant<
+              std::is_trivially_copyable_v<T> ||
+              requires { typename T::coz_trivially_relocatable; }> {};
+
+    template<class T>
+    inline constexpr bool is_trivially_relocatable_v =
+        is_trivially_relocatable<T>::value;
+
+    // Whether the frame has an intrusive link for the schedulers, see
+    // 'coro_queue'. Either specialize it or define a member type named
+    // 'coz_intrusive_link' in the Promise.
+    template<class Promise>
+    struct has_intrusive_link
+        : std::bool_constant<
+              requires { typename Promise::coz_intrusive_link; }> {};
+
+    template<class Promise>
+    inline constexpr bool has_intrusive_link_v =
+        has_intrusive_link<Promise>::value;
+} // namespace coz
+
 namespace coz::detail {
     enum : unsigned { SENTINEL = ~0u };
 
@@ -110,14 +144,25 @@ namespace coz::detail {
     struct size_align {
         std::size_t size;
         std::size_t align;
+        // Whether the objects can be trivially relocated.
+        bool relocatable = true;
+        // Whether an awaiter may request a symmetric transfer.
+        bool transfers = false;
 
         friend constexpr size_align unite(size_align a, size_align b) {
-            return {(std::max)(a.size, b.size), (std::max)(a.align, b.align)};
+            return {(std::max)(a.size, b.size), (std::max)(a.align, b.align),
+                    a.relocatable && b.relocatable,
+                    a.transfers || b.transfers};
         }
     };
 
     template<class T>
-    inline constexpr size_align size_align_of{sizeof(T), alignof(T)};
+    inline constexpr size_align size_align_of{sizeof(T), alignof(T),
+                                              is_trivially_relocatable_v<T>};
+
+    constexpr std::size_t align_up(std::size_t n, std::size_t align) {
+        return (n + align - 1) & ~(align - 1);
+    }
 
     // Stateful Metaprogramming trick described below:
     // https://mc-deltat.github.io/articles/stateful-metaprogramming-cpp20
@@ -170,12 +215,50 @@ namespace coz::detail {
     }
     // -------------------------------------------------------------------------
 
+    template<class PC>
+    inline constexpr PC pc_sentinel = static_cast<PC>(SENTINEL);
+
     // Program counters.
+    template<class PC>
     struct coro_state {
-        unsigned m_next = SENTINEL;
-        unsigned m_eh = SENTINEL;
+#if !defined(COZ_NO_EXCEPTIONS)
+        PC m_eh = pc_sentinel<PC>;
+#endif
+        PC m_next = pc_sentinel<PC>;
+    };
+
+    // The narrowest type that can hold the IPs in [0, Span) and the sentinel.
+    // The MSB of a valid IP is never 0xFF, so 'done' can be checked with the
+    // MSB only, which is located right before 'proto' on little-endian.
+    template<unsigned Span>
+    using pc_type = std::conditional_t<
+        std::endian::native != std::endian::little, unsigned,
+        std::conditional_t<
+            (Span <= 0xFF), std::uint8_t,
+            std::conditional_t<(Span <= 0xFF00), std::uint16_t, unsigned>>>;
+
+#if defined(COZ_USE_VTABLE)
+    struct coro_proto;
+
+    // One table per coroutine type. New entries can be appended without
+    // growing the frames.
+    struct coro_vtable {
+        void (*m_resume)(coro_proto*);
+        void (*m_destroy)(coro_proto*);
+    };
+
+    struct coro_proto {
+        const coro_vtable* m_vtbl;
     };
 
+    BOOST_FORCEINLINE void proto_resume(coro_proto* p) {
+        p->m_vtbl->m_resume(p);
+    }
+
+    BOOST_FORCEINLINE void proto_destroy(coro_proto* p) {
+        p->m_vtbl->m_destroy(p);
+    }
+#else
     // Common ABI as described at:
     // https://devblogs.microsoft.com/oldnewthing/20220103-00/?p=106109
     struct coro_proto {
@@ -183,9 +266,63 @@ namespace coz::detail {
         void (&m_destroy)(coro_proto*);
     };
 
-    // We place 'state' before 'proto' to optimize the access, as 'state' is
-    // accessed more directly, while 'proto' is for indirect access.
-    struct coro_base : coro_state, coro_proto {};
+    BOOST_FORCEINLINE void proto_resume(coro_proto* p) { p->m_resume(p); }
+
+    BOOST_FORCEINLINE void proto_destroy(coro_proto* p) { p->m_destroy(p); }
+#endif
+
+    // The link, if any, is placed right after 'proto', so it's found from the
+    // type-erased handle.
+    struct coro_link {
+        coro_proto* m_next = nullptr;
+    };
+
+    template<bool Linked>
+    struct coro_head : coro_proto {};
+
+    template<>
+    struct coro_head<true> : coro_proto {
+        coro_link m_link{};
+    };
+
+    // Only valid if the Promise has the link.
+    BOOST_FORCEINLINE coro_link* link_of(coro_proto* p) noexcept {
+        return &static_cast<coro_head<true>*>(p)->m_link;
+    }
+
+    // We place 'state' right before 'proto' to optimize the access, as
+    // 'state' is accessed more directly, while 'proto' is for indirect access.
+    template<class PC>
+    BOOST_FORCEINLINE coro_state<PC>* state_of(coro_proto* p) noexcept {
+        return reinterpret_cast<coro_state<PC>*>(p) - 1;
+    }
+
+    inline bool is_done(coro_proto* p) noexcept {
+        if constexpr (std::endian::native == std::endian::little) {
+            return reinterpret_cast<const std::uint8_t*>(p)[-1] == 0xFF;
+        } else {
+            return state_of<unsigned>(p)->m_next == SENTINEL;
+        }
+    }
+
+    // Pending target of symmetric transfer, drained by the outermost resume.
+    // Besides the awaiters returning a handle, only a Promise whose 'finalize'
+    // returns a handle may request it, since the coroutines that can't
+    // transfer don't drain it.
+    inline thread_local coro_proto* t_transfer = nullptr;
+
+    template<class Handle>
+    BOOST_FORCEINLINE void transfer_to(Handle h) noexcept {
+        t_transfer = static_cast<coro_proto*>(h.address());
+    }
+
+    // Trampoline that keeps the stack depth constant across transfers.
+    inline void run_transfer() {
+        while (coro_proto* p = t_transfer) {
+            t_transfer = nullptr;
+            proto_resume(p);
+        }
+    }
 
     template<class Promise, class Expr>
     BOOST_FORCEINLINE auto awt_trans(Promise* p, Expr&& expr)
@@ -199,11 +336,7 @@ namespace coz::detail {
     }
 
     template<class Promise>
-    struct coro_ctx : coro_base, Promise {
-        // Promote these names to avoid confliction with Promise.
-        using coro_base::m_eh;
-        using coro_base::m_next;
-
+    struct coro_ctx : coro_head<has_intrusive_link_v<Promise>>, Promise {
         // Use comma to transform the satisfied expr while leaving the
         // unsatisfied expr untouched.
         template<class Expr>
@@ -217,36 +350,91 @@ namespace coz::detail {
     struct finalizer {
         State* m_state;
         Promise* m_promise;
+#if !defined(COZ_NO_EXCEPTIONS)
+        int m_uncaught = std::uncaught_exceptions();
+#endif
 
         ~finalizer() {
             m_state->~State();
-            m_promise->finalize();
+            if constexpr (std::is_void_v<decltype(m_promise->finalize())>) {
+                m_promise->finalize();
+            } else {
+                auto next = m_promise->finalize();
+#if defined(COZ_NO_EXCEPTIONS)
+                transfer_to(next);
+#else
+                // Don't transfer if 'unhandled_exception' has thrown.
+                if (m_uncaught == std::uncaught_exceptions())
+                    transfer_to(next);
+#endif
+            }
         }
     };
 
-    template<size_align mem, class State>
+    // Layout: [mem_tmp][State][padding][state], immediately followed by the
+    // coro_ctx, which is aligned to Align.
+    template<size_align mem, class State, class PC, std::size_t Align>
     struct body {
-        alignas(mem.align) char m_mem_tmp[mem.size];
-        manual_lifetime<State> m_state;
+        static constexpr std::size_t state_offset =
+            align_up(mem.size, alignof(State));
+        static constexpr std::size_t size = align_up(
+            state_offset + sizeof(State) + sizeof(coro_state<PC>), Align);
 
-        template<class Promise>
-        void invoke(coro_ctx<Promise>* ctx) {
-            m_state.get()(ctx, m_mem_tmp);
+        static constexpr bool relocatable =
+            mem.relocatable && is_trivially_relocatable_v<State>;
+
+        static constexpr bool transfers = mem.transfers;
+
+        alignas(Align) std::uint8_t m_data[size];
+
+        body() noexcept { new (pcs()) coro_state<PC>; }
+
+        // Take over the state of a suspended coroutine.
+        void relocate(body& other) noexcept {
+            std::memcpy(m_data, other.m_data, size);
+            new (other.pcs()) coro_state<PC>;
+        }
+
+        coro_state<PC>* pcs() noexcept {
+            return reinterpret_cast<coro_state<PC>*>(m_data + size) - 1;
+        }
+
+        const coro_state<PC>* pcs() const noexcept {
+            return reinterpret_cast<const coro_state<PC>*>(m_data + size) - 1;
         }
-    };
 
-    template<class State>
-    struct body<size_align{}, State> {
-        manual_lifetime<State> m_state;
+        template<class Params>
+        void emplace(Params&& params) {
+            new (m_data + state_offset) State(std::move(params));
+        }
 
         template<class Promise>
         void invoke(coro_ctx<Promise>* ctx) {
-            m_state.get()(ctx, nullptr);
+            auto state = reinterpret_cast<State*>(m_data + state_offset);
+            if constexpr (mem.size == 0) {
+                (*state)(ctx, nullptr);
+            } else {
+                (*state)(ctx, m_data);
+            }
         }
     };
+
+    // The body is placed before the coro_ctx, see 'state_of'.
+    template<class Promise, class State>
+    using body_for =
+        body<decltype(std::declval<State>()(nullptr, nullptr))::value, State,
+             pc_type<State::_coz_span>,
+             (std::max)({decltype(std::declval<State>()(nullptr,
+                                                        nullptr))::value.align,
+                         alignof(State), alignof(coro_ctx<Promise>)})>;
 } // namespace coz::detail
 
 namespace coz {
+    // The referenced object may live in the frame.
+    template<class T>
+    struct is_trivially_relocatable<detail::lvref_wrapper<T>>
+        : std::false_type {};
+
     template<class Promise = void>
     struct coroutine_handle;
 
@@ -265,16 +453,19 @@ namespace coz {
             return m_ptr != nullptr;
         }
 
-        bool done() const noexcept {
-            return static_cast<detail::coro_base*>(m_ptr)->m_next ==
-                   detail::SENTINEL;
-        }
+        bool done() const noexcept { return detail::is_done(m_ptr); }
 
-        void operator()() const { m_ptr->m_resume(m_ptr); }
+        void operator()() const { resume(); }
 
-        void resume() const { m_ptr->m_resume(m_ptr); }
+        void resume() const {
+            detail::proto_resume(m_ptr);
+            detail::run_transfer();
+        }
 
-        void destroy() const noexcept { m_ptr->m_destroy(m_ptr); }
+        void destroy() const noexcept {
+            detail::proto_destroy(m_ptr);
+            detail::run_transfer();
+        }
 
     protected:
         constexpr coroutine_handle(detail::coro_proto* p) noexcept : m_ptr(p) {}
@@ -300,49 +491,134 @@ namespace coz {
     };
 
     template<class Promise, class Params, class State>
-    struct coroutine : private detail::coro_ctx<Promise> {
+    struct coroutine : private detail::body_for<Promise, State>,
+                       private detail::coro_ctx<Promise> {
         template<class Init>
         explicit coroutine(Init&& init)
-            : detail::coro_ctx<Promise>{{{}, {resume_impl, destroy_impl}},
-                                        Promise(std::forward<Init>(init))} {}
+            : detail::coro_ctx<Promise>{{proto_init},
+                                        Promise(std::forward<Init>(init))} {
+            assert(get_body().pcs() == detail::state_of<pc_t>(this));
+        }
 
         coroutine(const coroutine&) = delete;
         coroutine& operator=(const coroutine&) = delete;
 
-        coroutine_handle<Promise> handle() noexcept { return this; }
+        // Relocate the coroutine, which is either done or suspended. The
+        // latter requires 'relocatable', or it calls 'std::terminate'. The
+        // handles to 'other' are not updated, and 'other' becomes done.
+        coroutine(coroutine&& other) noexcept(
+            std::is_nothrow_move_constructible_v<Promise>)
+            : detail::coro_ctx<Promise>{{proto_init},
+                                        std::move(other.promise())} {
+            relocate_body(other);
+        }
+
+        coroutine& operator=(coroutine&& other) noexcept(
+            std::is_nothrow_move_assignable_v<Promise>) {
+            if (this != &other) {
+                if (!done())
+                    destroy();
+                promise() = std::move(other.promise());
+                relocate_body(other);
+            }
+            return *this;
+        }
+
+        // Whether a suspended coroutine can be relocated, i.e. the State, the
+        // Promise, the awaiters and the scoped locals are all trivially
+        // relocatable.
+        static constexpr bool relocatable =
+            detail::body_for<Promise, State>::relocatable &&
+            is_trivially_relocatable_v<Promise>;
+
+        coroutine_handle<Promise> handle() noexcept {
+            return coroutine_handle<Promise>::from_address(
+                static_cast<detail::coro_proto*>(this));
+        }
 
         Promise& promise() noexcept { return *this; }
 
         const Promise& promise() const noexcept { return *this; }
 
-        bool done() const noexcept { return this->m_next == detail::SENTINEL; }
+        bool done() const noexcept {
+            return get_body().pcs()->m_next == detail::pc_sentinel<pc_t>;
+        }
 
         void start(Params&& params) {
-            m_body.m_state.emplace(std::move(params));
-            this->m_next = 0;
-            m_body.invoke(this);
+            prepare(std::move(params));
+            resume();
         }
 
-        void resume() { m_body.invoke(this); }
+        // Like 'start', but the body runs on the next 'resume', e.g. via
+        // symmetric transfer.
+        void prepare(Params&& params) {
+            get_body().emplace(std::move(params));
+            get_body().pcs()->m_next = 0;
+        }
+
+        void resume() {
+            get_body().invoke(this);
+            if constexpr (transfers)
+                detail::run_transfer();
+        }
 
         void destroy() {
-            assert(this->m_next != detail::SENTINEL);
-            ++this->m_next;
-            m_body.invoke(this);
+            destroy_step();
+            if constexpr (transfers)
+                detail::run_transfer();
         }
 
     private:
+        using body_t = detail::body_for<Promise, State>;
+
+        // Whether the body may request a symmetric transfer. If not, there's
+        // nothing to drain after it runs, and skipping the trampoline lets
+        // the compiler keep the frame in registers when the coroutine is
+        // inlined into its consumer, e.g. a generator loop.
+        static constexpr bool transfers =
+            body_t::transfers ||
+            !std::is_void_v<decltype(std::declval<Promise&>().finalize())>;
+        using pc_t = detail::pc_type<State::_coz_span>;
+
+        body_t& get_body() noexcept { return *this; }
+
+        const body_t& get_body() const noexcept { return *this; }
+
+        void relocate_body(coroutine& other) noexcept {
+            if (!other.done()) {
+                if constexpr (relocatable) {
+                    get_body().relocate(other.get_body());
+                } else {
+                    // Copying the bytes would be undefined behavior, so
+                    // refuse it even with NDEBUG.
+                    std::terminate();
+                }
+            }
+        }
+
+        void destroy_step() {
+            assert(get_body().pcs()->m_next != detail::pc_sentinel<pc_t>);
+            ++get_body().pcs()->m_next;
+            get_body().invoke(this);
+        }
+
+        // These are called by the trampoline, so they must not drain it.
         static void resume_impl(detail::coro_proto* base) {
-            static_cast<coroutine*>(base)->resume();
+            auto self = static_cast<coroutine*>(base);
+            self->get_body().invoke(self);
         }
 
         static void destroy_impl(detail::coro_proto* base) {
-            static_cast<coroutine*>(base)->destroy();
+            static_cast<coroutine*>(base)->destroy_step();
         }
 
-        detail::body<decltype(std::declval<State>()(nullptr, nullptr))::value,
-                     State>
-            m_body;
+#if defined(COZ_USE_VTABLE)
+        static constexpr detail::coro_vtable s_vtbl{resume_impl, destroy_impl};
+        static constexpr detail::coro_proto proto_init{&s_vtbl};
+#else
+        static constexpr detail::coro_proto proto_init{resume_impl,
+                                                       destroy_impl};
+#endif
     };
 
     template<class Init, class Params, class State>
@@ -391,17 +667,34 @@ namespace coz::detail {
         p->return_value(std::forward<T>(value));
     }
 
-    template<class Expr, class Promise>
+    // Whether 'await_suspend' of the awaiter (or its wrapper) returns a handle.
+    template<class Promise, class T>
+    inline constexpr bool awaiter_transfers = [] {
+        using A = std::remove_pointer_t<decltype(unwrap_ptr(
+            std::declval<T*>()))>;
+        using R = decltype(std::declval<A&>().await_suspend(
+            std::declval<coroutine_handle<Promise>>()));
+        return !std::is_same_v<R, bool> && !std::is_void_v<R>;
+    }();
+
+    template<class Expr, class Promise, class PC>
     BOOST_FORCEINLINE bool try_suspend(Expr* p, coro_ctx<Promise>* ctx,
-                                       unsigned ip) {
+                                       coro_state<PC>* pc, unsigned ip) {
         if (p->await_ready())
             return false;
-        ctx->m_next = ip;
+        pc->m_next = ip;
         auto coro = coroutine_handle<Promise>::from_address(
             static_cast<coro_proto*>(ctx));
         using R = decltype(p->await_suspend(coro));
         if constexpr (std::is_same_v<R, bool>) {
             return p->await_suspend(coro);
+        } else if constexpr (std::is_convertible_v<R, coroutine_handle<>>) {
+            coroutine_handle<> next = p->await_suspend(coro);
+            // Transfer to self means resume immediately.
+            if (next.address() == coro.address())
+                return false;
+            transfer_to(next);
+            return true;
         } else {
             static_assert(std::is_same_v<R, void>);
             p->await_suspend(coro);
@@ -409,6 +702,49 @@ namespace coz::detail {
         }
     }
 
+    // 'yield_value' may return false to continue without suspending.
+    BOOST_FORCEINLINE constexpr bool yield_suspends(void_t) noexcept {
+        return true;
+    }
+
+    BOOST_FORCEINLINE constexpr bool yield_suspends(bool suspend) noexcept {
+        return suspend;
+    }
+
+    // The kept object yields its first value via 'yield_next' if the promise
+    // supports it for the object, otherwise via 'yield_value', as an lvalue if
+    // the promise only references it. Returns whether to suspend.
+    template<class Promise, class T>
+    BOOST_FORCEINLINE bool yield_kept(Promise* p, T* tmp) {
+        if constexpr (requires { p->yield_next(*unwrap_ptr(tmp)); }) {
+            return p->yield_next(*unwrap_ptr(tmp));
+        } else if constexpr (requires { p->yield_value(deref(tmp)); }) {
+            return yield_suspends(
+                (devoider{}, p->yield_value(deref(tmp)), void_t{}));
+        } else {
+            return yield_suspends(
+                (devoider{}, p->yield_value(*unwrap_ptr(tmp)), void_t{}));
+        }
+    }
+
+    // Whether the kept object yields another value on resume.
+    template<class Promise, class T>
+    BOOST_FORCEINLINE bool yield_next(Promise* p, T* tmp) {
+        if constexpr (requires { p->yield_next(*unwrap_ptr(tmp)); }) {
+            return p->yield_next(*unwrap_ptr(tmp));
+        } else {
+            return false;
+        }
+    }
+
+    // Called on 'destroy' while suspended on the awaiter, which should stop
+    // the pending operation from resuming the coroutine.
+    template<class Awaiter>
+    BOOST_FORCEINLINE void cancel_awaiter(Awaiter* p) noexcept {
+        if constexpr (requires { p->await_cancel(); })
+            p->await_cancel();
+    }
+
     template<class Domain, auto Tick>
     static consteval size_align get_size_align() {
         return smp_load_state<Domain, Tick>().value;
@@ -421,11 +757,119 @@ namespace coz::detail {
                                unite(Val, curr::value)>::state;
     }
 
-    template<class Domain, class T, auto Tick>
+    template<class Domain, class T, auto Tick, std::size_t Off = 0,
+             bool Transfers = false>
     constexpr auto update_size_align() {
-        return update_size_align_impl<size_align_of<T>, Domain, Tick>();
+        return update_size_align_impl<
+            size_align{Off + sizeof(T), alignof(T),
+                       is_trivially_relocatable_v<T>, Transfers},
+            Domain, Tick>();
+    };
+
+    // Scoped locals live in the temporary memory, after the ones of the
+    // enclosing scopes. The awaiters are placed after the innermost scope.
+    struct scope_root {
+        static constexpr std::size_t end = 0;
+
+        static void unwind(void*) noexcept {}
     };
 
+    template<class Vars, class Parent>
+    struct scope {
+        using vars = Vars;
+
+        static constexpr std::size_t offset =
+            align_up(Parent::end, alignof(Vars));
+        static constexpr std::size_t end = offset + sizeof(Vars);
+
+        static Vars* get(void* mem) noexcept {
+            return reinterpret_cast<Vars*>(static_cast<char*>(mem) + offset);
+        }
+
+        static void unwind(void* mem) noexcept {
+            get(mem)->~Vars();
+            Parent::unwind(mem);
+        }
+    };
+
+    template<class Scope, class T>
+    inline constexpr std::size_t tmp_offset = align_up(Scope::end, alignof(T));
+
+    template<class Scope, class T>
+    BOOST_FORCEINLINE void* tmp_at(void* mem) noexcept {
+        if constexpr (tmp_offset<Scope, T> == 0) {
+            return mem;
+        } else {
+            return static_cast<char*>(mem) + tmp_offset<Scope, T>;
+        }
+    }
+
+    // The scope occupies 3 IPs in its enclosing scope: resume, destroy and
+    // exception, in that order.
+    template<class Scope, class PC>
+    BOOST_FORCEINLINE void scope_enter(void* mem, coro_state<PC>* up,
+                                       unsigned ip) {
+        auto vars = new (Scope::get(mem)) typename Scope::vars;
+        vars->_coz_st.m_next = 0;
+        up->m_next = ip;
+#if !defined(COZ_NO_EXCEPTIONS)
+        up->m_eh = ip + 2;
+#endif
+    }
+
+    template<class Scope>
+    BOOST_FORCEINLINE void scope_destroy(void* mem) noexcept {
+        using vars = typename Scope::vars;
+        Scope::get(mem)->~vars();
+    }
+
+#if defined(COZ_NO_EXCEPTIONS)
+    template<class Scope, class PC>
+    BOOST_FORCEINLINE coro_state<PC>* scope_dispatch(void* mem,
+                                                     coro_state<PC>* up,
+                                                     unsigned ip, unsigned) {
+        coro_state<PC>* pc = &Scope::get(mem)->_coz_st;
+        if (up->m_next != ip) [[unlikely]] {
+            up->m_next = ip;
+            ++pc->m_next;
+        }
+        return pc;
+    }
+
+    template<class Scope, class PC>
+    BOOST_FORCEINLINE void scope_leave(void* mem, coro_state<PC>*,
+                                       unsigned) noexcept {
+        scope_destroy<Scope>(mem);
+    }
+#else
+    template<class Scope, class PC>
+    BOOST_FORCEINLINE coro_state<PC>*
+    scope_dispatch(void* mem, coro_state<PC>* up, unsigned ip, unsigned up_eh,
+                   manual_lifetime<std::exception_ptr>& ex) {
+        coro_state<PC>* pc = &Scope::get(mem)->_coz_st;
+        const unsigned mode = up->m_next - ip;
+        up->m_next = ip;
+        if (mode == 1) [[unlikely]] {
+            ++pc->m_next;
+        } else if (mode == 2) [[unlikely]] {
+            pc->m_next = pc->m_eh;
+            if (pc->m_next == pc_sentinel<PC>) {
+                up->m_eh = up_eh;
+                scope_destroy<Scope>(mem);
+                std::rethrow_exception(ex.release());
+            }
+        }
+        return pc;
+    }
+
+    template<class Scope, class PC>
+    BOOST_FORCEINLINE void scope_leave(void* mem, coro_state<PC>* up,
+                                       unsigned up_eh) noexcept {
+        up->m_eh = up_eh;
+        scope_destroy<Scope>(mem);
+    }
+#endif
+
     template<class T>
     concept HasReturnObject = requires(T* p) { p->get_return_object(); };
 
@@ -434,7 +878,11 @@ namespace coz::detail {
         return p->get_return_object();
     }
 
-    void get_return_object(const void*); // undefined
+    // Otherwise, the co_result itself is returned.
+    template<class T>
+    BOOST_FORCEINLINE T get_return_object(T* p) {
+        return std::move(*p);
+    }
 } // namespace coz::detail
 
 #define z_COZ_DEVOID(...) (_coz_::devoider{}, __VA_ARGS__, _coz_::void_t{})
@@ -456,6 +904,34 @@ namespace coz::detail {
 #define z_COZ_NEW_IP (__COUNTER__ - _coz_start)
 #define z_COZ_NEW_EH [[unlikely]] case z_COZ_NEW_IP
 
+// Without exceptions, there's no handler to retry from, and the exception
+// object isn't needed.
+#if defined(COZ_NO_EXCEPTIONS)
+#define z_COZ_EH_DECL
+#define z_COZ_EH_BEG {
+#define z_COZ_EH_END }
+#define z_COZ_EH_ARG
+#else
+// Value-initialized, so it's never read uninitialized on the paths that the
+// compiler can't prove to be preceded by 'emplace'.
+#define z_COZ_EH_DECL                                                          \
+    _coz_::manual_lifetime<std::exception_ptr> _coz_ex{};
+#define z_COZ_EH_BEG                                                           \
+    _coz_retry:                                                                \
+    try {
+#define z_COZ_EH_END                                                           \
+    } catch (...) {                                                            \
+        _coz_root_pc->m_next = _coz_root_pc->m_eh;                             \
+        if (_coz_root_pc->m_next != _coz_::pc_sentinel<_coz_pc_t>) {           \
+            _coz_ex.emplace(std::current_exception());                         \
+            goto _coz_retry;                                                   \
+        }                                                                      \
+        _coz_::finalizer fin{this, _coz_ctx};                                  \
+        _coz_ctx->unhandled_exception();                                       \
+    }
+#define z_COZ_EH_ARG , _coz_ex
+#endif
+
 // clang-format off
 // Begin of the coroutine body.
 #define COZ_BEG(init, args, ...)                                               \
@@ -476,46 +952,40 @@ namespace coz::detail {
             __VA_ARGS__                                                        \
             _coz_state(_coz_params&& params)                                   \
                 : _coz_params(std::move(params)) {}                            \
+            enum : unsigned { _coz_start = __COUNTER__ };                      \
             auto operator()(_coz_::coro_ctx<_coz_promise>* _coz_ctx,           \
                             void* _coz_mem_tmp) {                              \
                 _coz_::smp_init_state<_coz_state, _coz_::size_align{}>();      \
-                _coz_::manual_lifetime<std::exception_ptr> _coz_ex;            \
+                z_COZ_EH_DECL                                                  \
+                using _coz_pc_t = _coz_::pc_type<_coz_span>;                   \
+                _coz_::coro_state<_coz_pc_t>* const _coz_root_pc =             \
+                    _coz_::state_of<_coz_pc_t>(_coz_ctx);                      \
+                [[maybe_unused]] _coz_::coro_state<_coz_pc_t>* const _coz_pc = \
+                    _coz_root_pc;                                              \
+                typedef _coz_::scope_root _coz_scope_t;                        \
                 enum : unsigned {                                              \
-                    _coz_start = __COUNTER__,                                  \
-                    _coz_curr_eh = _coz_::SENTINEL                             \
+                    _coz_curr_eh = _coz_::pc_sentinel<_coz_pc_t>               \
                 };                                                             \
-            _coz_retry:                                                        \
-                try {                                                          \
-                    switch (_coz_ctx->m_next) {                                \
+                z_COZ_EH_BEG                                                   \
+                    switch (_coz_root_pc->m_next) {                            \
                     case 0:
 
 // End of the async body.
 #define COZ_END                                                                \
-                        _coz_ctx->m_next = _coz_::SENTINEL;                    \
+                        _coz_root_pc->m_next = _coz_::pc_sentinel<_coz_pc_t>;  \
                         _coz_::implicit_return(_coz_ctx);                      \
                     _coz_finalize:                                             \
                         _coz_::finalizer{this, _coz_ctx};                      \
                     }                                                          \
-                } catch (...) {                                                \
-                    _coz_ctx->m_next = _coz_ctx->m_eh;                         \
-                    if (_coz_ctx->m_next != _coz_::SENTINEL) {                 \
-                        _coz_ex.emplace(std::current_exception());             \
-                        goto _coz_retry;                                       \
-                    }                                                          \
-                    _coz_::finalizer fin{this, _coz_ctx};                      \
-                    _coz_ctx->unhandled_exception();                           \
-                }                                                              \
-            _coz_suspend:                                                      \
+                z_COZ_EH_END                                                   \
+            [[maybe_unused]] _coz_suspend:                                     \
                 return z_COZ_HIDE_MAGIC(                                       \
                     _coz_::smp_const<_coz_::get_size_align<                    \
                         _coz_state, _coz_::SENTINEL>()>{});                    \
             }                                                                  \
+            enum : unsigned { _coz_span = __COUNTER__ - _coz_start };          \
         };                                                                     \
-        if constexpr (_coz_::HasReturnObject<decltype(_coz_result)>) {         \
-            return _coz_::get_return_object(&_coz_result);                     \
-        } else {                                                               \
-            return _coz_result;                                                \
-        }                                                                      \
+        return _coz_::get_return_object(&_coz_result);                         \
     }
 
 // TODO: Adopt https://wg21.link/p2806 when available.
@@ -542,17 +1012,35 @@ namespace coz::detail {
 #define z_COZ_AWT(expr) (*_coz_ctx, expr)
 #define z_COZ_TMP(expr) (_coz_::lvrefer{}, expr)
 
+// Address of the temporary of type T in the current scope.
+#define z_COZ_TMP_PTR(T)                                                       \
+    static_cast<T*>(_coz_::tmp_at<_coz_scope_t, T>(_coz_mem_tmp))
+#define z_COZ_TMP_UPDATE(T, ip)                                                \
+    z_COZ_HIDE_MAGIC(_coz_::update_size_align<_coz_state, T, ip,               \
+                     _coz_::tmp_offset<_coz_scope_t, T>>())
+#define z_COZ_AWT_UPDATE(T, ip)                                                \
+    z_COZ_HIDE_MAGIC(_coz_::update_size_align<                                 \
+                     _coz_state, T, ip, _coz_::tmp_offset<_coz_scope_t, T>,    \
+                     _coz_::awaiter_transfers<_coz_promise, T>>())
+
+// Destroy the scoped locals and finalize the coroutine, which is done
+// afterwards, even when it's destroyed while suspended.
+#define z_COZ_UNWIND                                                           \
+    _coz_scope_t::unwind(_coz_mem_tmp);                                        \
+    _coz_root_pc->m_next = _coz_::pc_sentinel<_coz_pc_t>;                      \
+    goto _coz_finalize
+
 #define z_COZ_AWAIT_SUSPEND(expr)                                              \
     enum : unsigned { _coz_ip = z_COZ_NEW_IP };                                \
-    z_COZ_HIDE_MAGIC(                                                          \
-        _coz_::update_size_align<_coz_state, _coz_awt_t, _coz_ip>());          \
-    if (_coz_::try_suspend(                                                    \
-            _coz_::unwrap_ptr(new (_coz_mem_tmp) _coz_awt_t{z_COZ_AWT(expr)}), \
-            _coz_ctx, _coz_ip)) {                                              \
+    z_COZ_AWT_UPDATE(_coz_awt_t, _coz_ip);                                     \
+    if (_coz_::try_suspend(_coz_::unwrap_ptr(new (z_COZ_TMP_PTR(_coz_awt_t))   \
+                                                 _coz_awt_t{z_COZ_AWT(expr)}), \
+                           _coz_ctx, _coz_pc, _coz_ip)) {                      \
         goto _coz_suspend;                                                     \
     z_COZ_NEW_EH:                                                              \
-        static_cast<_coz_awt_t*>(_coz_mem_tmp)->~_coz_awt_t();                 \
-        goto _coz_finalize;                                                    \
+        _coz_::cancel_awaiter(_coz_::unwrap_ptr(z_COZ_TMP_PTR(_coz_awt_t)));   \
+        z_COZ_TMP_PTR(_coz_awt_t)->~_coz_awt_t();                              \
+        z_COZ_UNWIND;                                                          \
     }                                                                          \
     case _coz_ip:
 
@@ -565,7 +1053,7 @@ namespace coz::detail {
     do {                                                                       \
         using _coz_awt_t = decltype(_coz_::norvref(z_COZ_AWT(expr)));          \
         z_COZ_AWAIT_SUSPEND(expr) ret(_coz_::auto_reset {                      \
-            static_cast<_coz_awt_t*>(_coz_mem_tmp)                             \
+            z_COZ_TMP_PTR(_coz_awt_t)                                          \
         } -> await_resume() z_COZ_APPEND_ARGS(args));                          \
     } while (false)
 
@@ -575,7 +1063,7 @@ namespace coz::detail {
     } else                                                                     \
     label:                                                                     \
         if (init =                                                             \
-                _coz_::auto_reset { static_cast<_coz_awt_t*>(_coz_mem_tmp) }   \
+                _coz_::auto_reset { z_COZ_TMP_PTR(_coz_awt_t) }                \
             -> await_resume();                                                 \
             false) {                                                           \
         } else
@@ -584,7 +1072,7 @@ namespace coz::detail {
     z_COZ_AWAIT_EXPR_BEG using _coz_awt_t =                                    \
         decltype(_coz_::norvref(z_COZ_AWT(expr)));                             \
     z_COZ_AWAIT_SUSPEND(expr) z_COZ_AWAIT_EXPR_RET(_coz_::auto_reset {         \
-        static_cast<_coz_awt_t*>(_coz_mem_tmp)                                 \
+        z_COZ_TMP_PTR(_coz_awt_t)                                              \
     } -> await_resume());                                                      \
     z_COZ_AWAIT_EXPR_END
 
@@ -597,31 +1085,35 @@ namespace coz::detail {
 #define COZ_YIELD(expr)                                                        \
     do {                                                                       \
         enum : unsigned { _coz_ip = z_COZ_NEW_IP };                            \
-        _coz_ctx->yield_value(expr);                                           \
-        _coz_ctx->m_next = _coz_ip;                                            \
-        goto _coz_suspend;                                                     \
+        if (_coz_::yield_suspends(                                             \
+                z_COZ_DEVOID(_coz_ctx->yield_value(expr)))) {                  \
+            _coz_pc->m_next = _coz_ip;                                         \
+            goto _coz_suspend;                                                 \
+        }                                                                      \
     case _coz_ip:                                                              \
         break;                                                                 \
     z_COZ_NEW_EH:                                                              \
-        goto _coz_finalize;                                                    \
+        z_COZ_UNWIND;                                                          \
     } while (false)
 
 #define COZ_YIELD_KEEP(expr)                                                   \
     do {                                                                       \
         using _coz_tmp_t = decltype(_coz_::norvref(z_COZ_TMP(expr)));          \
         enum : unsigned { _coz_ip = z_COZ_NEW_IP };                            \
-        z_COZ_HIDE_MAGIC(                                                      \
-            _coz_::update_size_align<_coz_state, _coz_tmp_t, _coz_ip>());      \
-        _coz_ctx->yield_value(                                                 \
-            _coz_::deref(new (_coz_mem_tmp) _coz_tmp_t{z_COZ_TMP(expr)}));     \
-        _coz_ctx->m_next = _coz_ip;                                            \
-        goto _coz_suspend;                                                     \
-    case _coz_ip:                                                              \
-        static_cast<_coz_tmp_t*>(_coz_mem_tmp)->~_coz_tmp_t();                 \
+        z_COZ_TMP_UPDATE(_coz_tmp_t, _coz_ip);                                 \
+        if (_coz_::yield_kept(_coz_ctx, new (z_COZ_TMP_PTR(_coz_tmp_t))        \
+                                            _coz_tmp_t{z_COZ_TMP(expr)})) {    \
+            _coz_pc->m_next = _coz_ip;                                         \
+            goto _coz_suspend;                                                 \
+        case _coz_ip:                                                          \
+            if (_coz_::yield_next(_coz_ctx, z_COZ_TMP_PTR(_coz_tmp_t)))        \
+                goto _coz_suspend;                                             \
+        }                                                                      \
+        z_COZ_TMP_PTR(_coz_tmp_t)->~_coz_tmp_t();                              \
         break;                                                                 \
     z_COZ_NEW_EH:                                                              \
-        static_cast<_coz_tmp_t*>(_coz_mem_tmp)->~_coz_tmp_t();                 \
-        goto _coz_finalize;                                                    \
+        z_COZ_TMP_PTR(_coz_tmp_t)->~_coz_tmp_t();                              \
+        z_COZ_UNWIND;                                                          \
     } while (false)
 
 #define z_COZ_RETURN0(t) _coz_ctx->return_void()
@@ -631,21 +1123,76 @@ namespace coz::detail {
 
 #define COZ_RETURN(...)                                                        \
     do {                                                                       \
-        _coz_ctx->m_next = _coz_::SENTINEL;                                    \
+        _coz_root_pc->m_next = _coz_::pc_sentinel<_coz_pc_t>;                  \
         z_COZ_RETURN((__VA_ARGS__));                                           \
-        goto _coz_finalize;                                                    \
+        z_COZ_UNWIND;                                                          \
     } while (false)
 
+#if !defined(COZ_NO_EXCEPTIONS)
 #define COZ_TRY                                                                \
     if (enum                                                                   \
         : unsigned{_coz_prev_eh = _coz_curr_eh, _coz_curr_eh = z_COZ_NEW_IP};  \
-        _coz_ctx->m_eh = _coz_curr_eh, true)
+        _coz_pc->m_eh = _coz_curr_eh, true)
 
 #define COZ_CATCH                                                              \
     else case _coz_curr_eh:                                                    \
     try {                                                                      \
-        _coz_ctx->m_eh = _coz_prev_eh;                                         \
+        _coz_pc->m_eh = _coz_prev_eh;                                          \
         std::rethrow_exception(_coz_ex.release());                             \
     } catch
+#endif
 
-#endif
\ No newline at end of file
+// COZ_SCOPE without the switch, so that a declaration in front of it is
+// re-evaluated when the block is resumed.
+#define z_COZ_SCOPE(name, ...)                                                 \
+    if (enum : unsigned {                                                      \
+            _coz_scope_ip = z_COZ_NEW_IP,                                      \
+            _coz_scope_dtor = z_COZ_NEW_IP,                                    \
+            _coz_scope_exc = z_COZ_NEW_IP,                                     \
+            _coz_scope_up_eh = _coz_curr_eh,                                   \
+            _coz_curr_eh = _coz_::pc_sentinel<_coz_pc_t>                       \
+        };                                                                     \
+        false) {                                                               \
+    } else if (struct _coz_scope_vars {                                        \
+                   _coz_::coro_state<_coz_pc_t> _coz_st;                       \
+                   __VA_ARGS__                                                 \
+               };                                                              \
+               false) {                                                        \
+    } else if (typedef _coz_::scope<_coz_scope_vars, _coz_scope_t>             \
+                   _coz_scope_t;                                               \
+               z_COZ_HIDE_MAGIC(                                               \
+                   _coz_::update_size_align<_coz_state, _coz_scope_vars,       \
+                                            _coz_scope_ip,                     \
+                                            _coz_scope_t::offset>(), )         \
+                   _coz_::scope_enter<_coz_scope_t>(_coz_mem_tmp, _coz_pc,     \
+                                                    _coz_scope_ip),            \
+               false) {                                                        \
+    } else                                                                     \
+    case _coz_scope_ip:                                                        \
+    [[unlikely]] case _coz_scope_dtor:                                         \
+    [[unlikely]] case _coz_scope_exc:                                          \
+        if ([[maybe_unused]] _coz_scope_vars& name =                           \
+                *_coz_scope_t::get(_coz_mem_tmp);                              \
+            false) {                                                           \
+        } else if (auto* _coz_pc_up = _coz_pc; false) {                        \
+        } else if (_coz_::coro_state<_coz_pc_t>* _coz_pc =                     \
+                       _coz_::scope_dispatch<_coz_scope_t>(                    \
+                           _coz_mem_tmp, _coz_pc_up, _coz_scope_ip,            \
+                           _coz_scope_up_eh z_COZ_EH_ARG);                     \
+                   false) {                                                    \
+        } else                                                                 \
+            for (bool _coz_once = true; _coz_once;                             \
+                 _coz_once = false, _coz_::scope_leave<_coz_scope_t>(          \
+                                        _coz_mem_tmp, _coz_pc_up,              \
+                                        _coz_scope_up_eh))
+
+// Locals that only live in the following block. Their storage is reused by
+// the sibling scopes, and they're accessed via `name.var`. The block is the
+// body of a loop, so `break` and `continue` directly in it leave the scope
+// instead of an enclosing loop.
+#define COZ_SCOPE(name, ...)                                                   \
+    z_COZ_SCOPE(name, __VA_ARGS__)                                             \
+    switch (_coz_pc->m_next)                                                   \
+    case 0:
+
+#endif
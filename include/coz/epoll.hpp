@@ -0,0 +1,365 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_EPOLL_HPP
+#define COZ_EPOLL_HPP
+
+#include <chrono>
+#include <algorithm>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <climits>
+#include <cstdlib>
+#include <utility>
+#include <system_error>
+#include <unistd.h>
+#include <sys/epoll.h>
+#include <sys/socket.h>
+#include <coz/coroutine.hpp>
+
+namespace coz::detail {
+    // A suspended operation, which lives in its awaiter.
+    struct epoll_waiter {
+        // Try the operation on readiness, returns false if it would block.
+        bool (*m_perform)(epoll_waiter* self) noexcept;
+        coroutine_handle<> m_coro{};
+        epoll_waiter* m_next = nullptr;
+        // In the ready list of the context rather than that of the fd.
+        bool m_ready = false;
+    };
+
+    struct epoll_waiter_list {
+        bool empty() const noexcept { return m_head == nullptr; }
+
+        epoll_waiter* front() const noexcept { return m_head; }
+
+        void push_back(epoll_waiter* w) noexcept {
+            if (m_tail) {
+                m_tail->m_next = w;
+            } else {
+                m_head = w;
+            }
+            m_tail = w;
+        }
+
+        epoll_waiter* pop_front() noexcept {
+            epoll_waiter* w = m_head;
+            m_head = std::exchange(w->m_next, nullptr);
+            if (!m_head)
+                m_tail = nullptr;
+            return w;
+        }
+
+        // O(n), only on cancellation.
+        void erase(epoll_waiter* w) noexcept {
+            epoll_waiter* prev = nullptr;
+            for (epoll_waiter* it = m_head; it != w; prev = it, it = it->m_next)
+                assert(it);
+            (prev ? prev->m_next : m_head) = w->m_next;
+            if (m_tail == w)
+                m_tail = prev;
+            w->m_next = nullptr;
+        }
+
+        epoll_waiter* m_head = nullptr;
+        epoll_waiter* m_tail = nullptr;
+    };
+
+    [[noreturn]] inline void throw_epoll_error(const char* what) {
+#if defined(COZ_NO_EXCEPTIONS)
+        (void)what;
+        std::abort();
+#else
+        throw std::system_error(errno, std::system_category(), what);
+#endif
+    }
+} // namespace coz::detail
+
+namespace coz {
+    struct epoll_descriptor;
+
+    // Reactor on edge-triggered epoll, for the kernels without io_uring.
+    // The waiters are linked through their awaiters, so it never allocates.
+    // Not thread-safe.
+    struct epoll_context {
+        epoll_context() : m_fd(::epoll_create1(EPOLL_CLOEXEC)) {
+            if (m_fd < 0)
+                detail::throw_epoll_error("epoll_create1");
+        }
+
+        epoll_context(const epoll_context&) = delete;
+        epoll_context& operator=(const epoll_context&) = delete;
+
+        // The coroutines waiting on it must have been destroyed.
+        ~epoll_context() {
+            assert(m_waiting == 0 && m_ready.empty());
+            ::close(m_fd);
+        }
+
+        // Resume the coroutines until none is waiting, returns the number of
+        // resumptions.
+        std::size_t run() {
+            std::size_t n = 0;
+            while (dispatch_one(-1))
+                ++n;
+            return n;
+        }
+
+        // Resume at most one coroutine, waits if there's a waiting one.
+        bool run_one() { return dispatch_one(-1); }
+
+        // Like 'run_one', but waits at most 'timeout', even if no coroutine
+        // is waiting, e.g. for the next timer.
+        bool run_one_for(std::chrono::nanoseconds timeout) {
+            // Round up, so that it doesn't wake before the timer expires.
+            const auto ms =
+                std::chrono::ceil<std::chrono::milliseconds>(timeout).count();
+            return dispatch_one(int(std::clamp<decltype(ms)>(ms, 0, INT_MAX)));
+        }
+
+        // Like 'run', but doesn't wait.
+        std::size_t poll() {
+            std::size_t n = 0;
+            while (dispatch_one(0))
+                ++n;
+            return n;
+        }
+
+        // The number of suspended operations.
+        std::size_t waiting() const noexcept { return m_waiting; }
+
+    private:
+        friend epoll_descriptor;
+
+        static constexpr int max_events = 64;
+
+        bool dispatch_one(int timeout);
+
+        void wait(detail::epoll_waiter_list& list, detail::epoll_waiter* w,
+                  coroutine_handle<> coro) noexcept {
+            w->m_coro = coro;
+            list.push_back(w);
+            ++m_waiting;
+        }
+
+        void cancel(detail::epoll_waiter_list& list,
+                    detail::epoll_waiter* w) noexcept {
+            if (w->m_ready) {
+                m_ready.erase(w);
+            } else {
+                list.erase(w);
+                --m_waiting;
+            }
+        }
+
+        // The fd became ready, move the waiters whose operation doesn't
+        // block to the ready list.
+        bool wake(detail::epoll_waiter_list& list) noexcept {
+            while (!list.empty()) {
+                detail::epoll_waiter* w = list.front();
+                if (!w->m_perform(w))
+                    return false;
+                list.pop_front();
+                w->m_ready = true;
+                m_ready.push_back(w);
+                --m_waiting;
+            }
+            return true;
+        }
+
+        int m_fd;
+        std::size_t m_waiting = 0;
+        detail::epoll_waiter_list m_ready;
+    };
+
+    // The registration of a non-blocking fd, which it doesn't own. It's
+    // registered once for both directions, and remembers the readiness until
+    // an operation would block.
+    struct epoll_descriptor {
+        epoll_descriptor(epoll_context& ctx, int fd) : m_ctx(&ctx), m_fd(fd) {
+            epoll_event ev{};
+            ev.events = EPOLLIN | EPOLLOUT | EPOLLRDHUP | EPOLLET;
+            ev.data.ptr = this;
+            if (::epoll_ctl(ctx.m_fd, EPOLL_CTL_ADD, fd, &ev) != 0)
+                detail::throw_epoll_error("epoll_ctl");
+        }
+
+        epoll_descriptor(const epoll_descriptor&) = delete;
+        epoll_descriptor& operator=(const epoll_descriptor&) = delete;
+
+        // No coroutine may be waiting on it.
+        ~epoll_descriptor() {
+            assert(m_readers.empty() && m_writers.empty());
+            ::epoll_ctl(m_ctx->m_fd, EPOLL_CTL_DEL, m_fd, nullptr);
+        }
+
+        int native_handle() const noexcept { return m_fd; }
+
+        // Forget the readiness, e.g. after a syscall by the user returned
+        // EAGAIN.
+        void clear_readable() noexcept { m_readable = false; }
+        void clear_writable() noexcept { m_writable = false; }
+
+        template<bool Write>
+        struct readiness_awaiter : private detail::epoll_waiter {
+            explicit readiness_awaiter(epoll_descriptor* d) noexcept
+                : detail::epoll_waiter{perform}, m_desc(d) {}
+
+            bool await_ready() const noexcept {
+                return Write ? m_desc->m_writable : m_desc->m_readable;
+            }
+
+            void await_suspend(coroutine_handle<> coro) noexcept {
+                m_desc->m_ctx->wait(m_desc->list(Write), this, coro);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept {
+                m_desc->m_ctx->cancel(m_desc->list(Write), this);
+            }
+
+        private:
+            static bool perform(detail::epoll_waiter*) noexcept { return true; }
+
+            epoll_descriptor* m_desc;
+        };
+
+        // The syscall is tried first, and only suspends on EAGAIN. The result
+        // is that of the syscall, i.e. a negative errno on failure.
+        template<bool Write>
+        struct [[nodiscard]] io_awaiter : private detail::epoll_waiter {
+            io_awaiter(epoll_descriptor* d, void* buf, std::size_t len,
+                       int flags) noexcept
+                : detail::epoll_waiter{perform}, m_desc(d), m_buf(buf),
+                  m_len(len), m_flags(flags) {}
+
+            bool await_ready() noexcept {
+                if (try_io())
+                    return true;
+                (Write ? m_desc->m_writable : m_desc->m_readable) = false;
+                return false;
+            }
+
+            void await_suspend(coroutine_handle<> coro) noexcept {
+                m_desc->m_ctx->wait(m_desc->list(Write), this, coro);
+            }
+
+            ssize_t await_resume() const noexcept { return m_res; }
+
+            void await_cancel() noexcept {
+                m_desc->m_ctx->cancel(m_desc->list(Write), this);
+            }
+
+        private:
+            bool try_io() noexcept {
+                ssize_t n;
+                do {
+                    if (m_flags < 0) {
+                        n = Write ? ::write(m_desc->m_fd, m_buf, m_len)
+                                  : ::read(m_desc->m_fd, m_buf, m_len);
+                    } else {
+                        n = Write ? ::send(m_desc->m_fd, m_buf, m_len, m_flags)
+                                  : ::recv(m_desc->m_fd, m_buf, m_len, m_flags);
+                    }
+                } while (n < 0 && errno == EINTR);
+                if (n < 0) {
+                    if (errno == EAGAIN || errno == EWOULDBLOCK)
+                        return false;
+                    n = -errno;
+                }
+                m_res = n;
+                return true;
+            }
+
+            static bool perform(detail::epoll_waiter* self) noexcept {
+                return static_cast<io_awaiter*>(self)->try_io();
+            }
+
+            epoll_descriptor* m_desc;
+            void* m_buf;
+            std::size_t m_len;
+            // Negative for read/write.
+            int m_flags;
+            ssize_t m_res = 0;
+        };
+
+        readiness_awaiter<false> readable() noexcept {
+            return readiness_awaiter<false>(this);
+        }
+
+        readiness_awaiter<true> writable() noexcept {
+            return readiness_awaiter<true>(this);
+        }
+
+        io_awaiter<false> async_read(void* buf, std::size_t len) noexcept {
+            return {this, buf, len, -1};
+        }
+
+        io_awaiter<true> async_write(const void* buf,
+                                     std::size_t len) noexcept {
+            return {this, const_cast<void*>(buf), len, -1};
+        }
+
+        io_awaiter<false> async_recv(void* buf, std::size_t len,
+                                     int flags = 0) noexcept {
+            return {this, buf, len, flags};
+        }
+
+        io_awaiter<true> async_send(const void* buf, std::size_t len,
+                                    int flags = MSG_NOSIGNAL) noexcept {
+            return {this, const_cast<void*>(buf), len, flags};
+        }
+
+    private:
+        friend epoll_context;
+
+        detail::epoll_waiter_list& list(bool write) noexcept {
+            return write ? m_writers : m_readers;
+        }
+
+        void on_event(std::uint32_t events) noexcept {
+            if (events & (EPOLLIN | EPOLLRDHUP | EPOLLHUP | EPOLLERR))
+                m_readable = m_ctx->wake(m_readers);
+            if (events & (EPOLLOUT | EPOLLHUP | EPOLLERR))
+                m_writable = m_ctx->wake(m_writers);
+        }
+
+        epoll_context* m_ctx;
+        int m_fd;
+        bool m_readable = false;
+        bool m_writable = false;
+        detail::epoll_waiter_list m_readers;
+        detail::epoll_waiter_list m_writers;
+    };
+
+    inline bool epoll_context::dispatch_one(int timeout) {
+        for (bool waited = false;; waited = true) {
+            if (!m_ready.empty()) {
+                detail::epoll_waiter* w = m_ready.pop_front();
+                w->m_ready = false;
+                w->m_coro.resume();
+                return true;
+            }
+            if ((m_waiting == 0 && timeout < 0) || (waited && timeout >= 0))
+                return false;
+            // All the events are handled before any coroutine is resumed, so
+            // the descriptors are still alive.
+            epoll_event events[max_events];
+            const int n = ::epoll_wait(m_fd, events, max_events, timeout);
+            if (n < 0 && errno != EINTR)
+                detail::throw_epoll_error("epoll_wait");
+            for (int i = 0; i < n; ++i) {
+                static_cast<epoll_descriptor*>(events[i].data.ptr)
+                    ->on_event(events[i].events);
+            }
+        }
+    }
+} // namespace coz
+
+#endif
@@ -0,0 +1,487 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_FUSED_GENERATOR_HPP
+#define COZ_FUSED_GENERATOR_HPP
+
+#include <span>
+#include <array>
+#include <cstddef>
+#include <utility>
+#include <optional>
+#include <functional>
+#include <coz/generator.hpp>
+
+// A stage is bound to its input type V, and it has:
+// * `output` - the type it passes downstream.
+// * `stops` - whether it may call `next.stop()`. If none of the stages does,
+//   the generator doesn't check for it on every element.
+// * `bool push(U&& v, Next& next)` - process an element, returns whether an
+//   element was delivered to the consumer.
+// * `bool flush(Next& next)` - deliver the buffered elements one at a time,
+//   returns false when there's nothing left.
+// `Next` is the downstream, which has `push(u)`, `flush()` and `stop()`, the
+// latter ends the generator after the elements already pushed.
+namespace coz::detail {
+    template<class A>
+    concept fuse_adaptor = requires { typename A::is_fuse_adaptor; };
+
+    template<class B, class Next>
+    struct fuse_link {
+        template<class U>
+        bool push(U&& u) {
+            return m_b->push(std::forward<U>(u), *m_next);
+        }
+
+        bool flush() { return m_b->flush(*m_next); }
+
+        void stop() noexcept { m_next->stop(); }
+
+        B* m_b;
+        Next* m_next;
+    };
+
+    template<class A, class B>
+    struct fuse_chain {
+        using output = typename B::output;
+
+        static constexpr bool stops = A::stops || B::stops;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            fuse_link<B, Next> link{&m_b, &next};
+            return m_a.push(std::forward<U>(u), link);
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            fuse_link<B, Next> link{&m_b, &next};
+            return m_a.flush(link);
+        }
+
+        A m_a;
+        B m_b;
+    };
+
+    template<class A, class B>
+    struct fuse_compose {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        auto bind() && {
+            auto a = std::move(m_a).template bind<V>();
+            using W = typename decltype(a)::output;
+            return fuse_chain<decltype(a),
+                              decltype(std::move(m_b).template bind<W>())>{
+                std::move(a), std::move(m_b).template bind<W>()};
+        }
+
+        A m_a;
+        B m_b;
+    };
+
+    template<class V>
+    struct identity_stage {
+        using output = V;
+
+        static constexpr bool stops = false;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            return next.push(std::forward<U>(u));
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            return next.flush();
+        }
+    };
+
+    struct identity_adaptor {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        identity_stage<V> bind() && {
+            return {};
+        }
+    };
+
+    template<class F, class V>
+    struct map_stage {
+        using output = std::remove_cvref_t<std::invoke_result_t<F&, V&&>>;
+
+        static constexpr bool stops = false;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            return next.push(std::invoke(m_f, std::forward<U>(u)));
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            return next.flush();
+        }
+
+        F m_f;
+    };
+
+    template<class F>
+    struct map_adaptor {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        map_stage<F, V> bind() && {
+            return {std::move(m_f)};
+        }
+
+        F m_f;
+    };
+
+    template<class F, class V>
+    struct filter_stage {
+        using output = V;
+
+        static constexpr bool stops = false;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            if (std::invoke(m_pred, std::as_const(u)))
+                return next.push(std::forward<U>(u));
+            return false;
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            return next.flush();
+        }
+
+        F m_pred;
+    };
+
+    template<class F>
+    struct filter_adaptor {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        filter_stage<F, V> bind() && {
+            return {std::move(m_pred)};
+        }
+
+        F m_pred;
+    };
+
+    template<class V>
+    struct take_stage {
+        using output = V;
+
+        static constexpr bool stops = true;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            if (m_n == 0) {
+                next.stop();
+                return false;
+            }
+            const bool delivered = next.push(std::forward<U>(u));
+            if (--m_n == 0)
+                next.stop();
+            return delivered;
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            return next.flush();
+        }
+
+        std::size_t m_n;
+    };
+
+    struct take_adaptor {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        take_stage<V> bind() && {
+            return {m_n};
+        }
+
+        std::size_t m_n;
+    };
+
+    // The span refers to the buffer, which is only refilled after the
+    // consumer resumes the generator.
+    template<class V, std::size_t N>
+    struct chunk_stage {
+        static_assert(N > 0);
+
+        using output = std::span<V>;
+
+        static constexpr bool stops = false;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            m_buf[m_size] = std::forward<U>(u);
+            if (++m_size != N)
+                return false;
+            m_size = 0;
+            return next.push(std::span<V>(m_buf.data(), N));
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            if (const std::size_t n = std::exchange(m_size, 0)) {
+                if (next.push(std::span<V>(m_buf.data(), n)))
+                    return true;
+            }
+            return next.flush();
+        }
+
+        std::array<V, N> m_buf;
+        std::size_t m_size = 0;
+    };
+
+    template<std::size_t N>
+    struct chunk_adaptor {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        chunk_stage<V, N> bind() && {
+            return {};
+        }
+    };
+
+    template<class R, class V>
+    struct zip_stage {
+        using output = std::pair<V, std::ranges::range_reference_t<R>>;
+
+        static constexpr bool stops = true;
+
+        template<class U, class Next>
+        bool push(U&& u, Next& next) {
+            if (!m_it) {
+                m_it.emplace(std::ranges::begin(m_range));
+                m_end.emplace(std::ranges::end(m_range));
+            }
+            if (*m_it == *m_end) {
+                next.stop();
+                return false;
+            }
+            const bool delivered =
+                next.push(output(std::forward<U>(u), **m_it));
+            ++*m_it;
+            return delivered;
+        }
+
+        template<class Next>
+        bool flush(Next& next) {
+            return next.flush();
+        }
+
+        R m_range;
+        std::optional<std::ranges::iterator_t<R>> m_it;
+        std::optional<std::ranges::sentinel_t<R>> m_end;
+    };
+
+    template<class R>
+    struct zip_adaptor {
+        using is_fuse_adaptor = void;
+
+        template<class V>
+        zip_stage<R, V> bind() && {
+            return {std::move(m_range)};
+        }
+
+        R m_range;
+    };
+
+    template<fuse_adaptor A, fuse_adaptor B>
+    fuse_compose<A, B> operator|(A a, B b) {
+        return {std::move(a), std::move(b)};
+    }
+} // namespace coz::detail
+
+namespace coz {
+    // Adaptors that run inside 'yield_value' of the generator, so an element
+    // that doesn't reach the consumer costs no suspension.
+    namespace fuse {
+        constexpr detail::identity_adaptor identity{};
+
+        template<class F>
+        detail::map_adaptor<std::decay_t<F>> map(F&& f) {
+            return {std::forward<F>(f)};
+        }
+
+        template<class F>
+        detail::filter_adaptor<std::decay_t<F>> filter(F&& pred) {
+            return {std::forward<F>(pred)};
+        }
+
+        inline detail::take_adaptor take(std::size_t n) noexcept { return {n}; }
+
+        // Pass the elements in spans of N, the last one may be shorter.
+        template<std::size_t N>
+        detail::chunk_adaptor<N> chunk() noexcept {
+            return {};
+        }
+
+        // Pair each element with the one of the range, and end when either is
+        // exhausted.
+        template<std::ranges::viewable_range R>
+        detail::zip_adaptor<std::views::all_t<R>> zip(R&& r) {
+            return {std::views::all(std::forward<R>(r))};
+        }
+    } // namespace fuse
+
+    // The Policy of the generator with fused stages.
+    template<class Stage>
+    struct fused {};
+
+    template<class T, class Stage>
+    struct fused_init {
+        using promise_type = generator_promise<T, fused<Stage>>;
+
+        Stage m_stage;
+    };
+
+    template<class T, class Stage>
+    struct generator_promise<T, fused<Stage>>
+        : private detail::generator_storage<typename Stage::output, by_value> {
+        using element_type = typename Stage::output;
+
+        explicit generator_promise(fused_init<T, Stage> init)
+            : m_stage(std::move(init.m_stage)) {}
+
+        // Only valid before started.
+        generator_promise(generator_promise&& other)
+            : m_stage(std::move(other.m_stage)) {}
+
+        ~generator_promise() { drop(); }
+
+        void finalize() noexcept {}
+
+        template<class U = T>
+        bool yield_value(U&& u) {
+            sink s{this};
+            bool delivered;
+            if constexpr (std::is_same_v<std::remove_cvref_t<U>, T>) {
+                delivered = m_stage.push(std::forward<U>(u), s);
+            } else {
+                delivered = m_stage.push(T(std::forward<U>(u)), s);
+            }
+            if constexpr (Stage::stops) {
+                if (m_draining) {
+                    if (!delivered)
+                        drain();
+                    return true;
+                }
+            }
+            return delivered;
+        }
+
+        // The buffered elements are still delivered.
+        void return_void() {
+            m_draining = true;
+            drain();
+        }
+
+#if !defined(COZ_NO_EXCEPTIONS)
+        void unhandled_exception() { throw; }
+#endif
+
+    private:
+        template<class T2, class Policy2, class Params, class State>
+        friend struct generator_range;
+
+        struct sink {
+            template<class U>
+            bool push(U&& u) {
+                m_self->put(std::forward<U>(u));
+                return true;
+            }
+
+            bool flush() noexcept { return false; }
+
+            void stop() noexcept { m_self->m_draining = true; }
+
+            generator_promise* m_self;
+        };
+
+        void drop() noexcept {
+            if (this->m_ptr) {
+                detail::generator_storage<element_type, by_value>::drop();
+                this->m_ptr = nullptr;
+            }
+        }
+
+        // The generator is not resumed once stopped.
+        void drain() {
+            sink s{this};
+            m_stage.flush(s);
+        }
+
+        // Without a stage that stops, it only drains after returning. Testing
+        // 'done' then reads the same PC as the dispatch of 'resume', so the
+        // check folds into it when inlined.
+        template<class Coro>
+        bool draining(const Coro& coro) const noexcept {
+            if constexpr (Stage::stops) {
+                return m_draining;
+            } else {
+                return coro.done();
+            }
+        }
+
+        template<class Coro>
+        void advance(Coro& coro) {
+            drop();
+            if (draining(coro)) {
+                drain();
+            } else {
+                coro.resume();
+            }
+        }
+
+        Stage m_stage;
+        bool m_draining = false;
+    };
+
+    template<class T, class Stage, class Params, class State>
+    struct co_result<fused_init<T, Stage>, Params, State> {
+        fused_init<T, Stage> m_init;
+        Params m_params;
+
+        generator_range<T, fused<Stage>, Params, State> get_return_object() {
+            return generator_range<T, fused<Stage>, Params, State>(
+                std::move(m_init), std::move(m_params));
+        }
+    };
+} // namespace coz
+
+namespace coz::detail {
+    // `coz::generator<T> | adaptor` is the promise-initializer of the fused
+    // generator.
+    template<class T, fuse_adaptor A>
+    auto operator|(default_init<generator_promise<T, by_value>>, A a) {
+        using stage = decltype(std::move(a).template bind<T>());
+        return fused_init<T, stage>{std::move(a).template bind<T>()};
+    }
+
+    template<class T>
+    default_init<generator_promise<T, by_value>>
+    operator|(default_init<generator_promise<T, by_value>> init,
+              identity_adaptor) noexcept {
+        return init;
+    }
+
+    template<class T, class Stage, fuse_adaptor A>
+    auto operator|(fused_init<T, Stage> init, A a) {
+        using W = typename Stage::output;
+        using stage = decltype(std::move(a).template bind<W>());
+        return fused_init<T, fuse_chain<Stage, stage>>{
+            {std::move(init.m_stage), std::move(a).template bind<W>()}};
+    }
+} // namespace coz::detail
+
+#endif
@@ -0,0 +1,342 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_GENERATOR_HPP
+#define COZ_GENERATOR_HPP
+
+#include <new>
+#include <span>
+#include <array>
+#include <ranges>
+#include <memory>
+#include <optional>
+#include <iterator>
+#include <coz/coroutine.hpp>
+
+namespace coz {
+    // Yield policies, i.e. how the yielded values are passed to the consumer.
+    // The yielded value is copied into the promise.
+    struct by_value {};
+    // The yielded object is referenced, it must live until resumed.
+    struct by_reference {};
+    // A pointer to the object is yielded.
+    struct by_pointer {};
+
+    // Yield the elements of the range one by one, which must be done via
+    // COZ_YIELD_KEEP, so the range and its iterator live in the frame.
+    template<class R>
+    struct elements_of {
+        explicit elements_of(R&& r) : range(std::forward<R>(r)) {}
+
+        R range;
+        std::optional<std::ranges::iterator_t<R>> m_it;
+        std::optional<std::ranges::sentinel_t<R>> m_end;
+    };
+
+    template<class R>
+    elements_of(R&&) -> elements_of<R>;
+} // namespace coz
+
+namespace coz::detail {
+    template<class T, class Policy>
+    struct generator_storage {
+        void put(T* p) noexcept { m_ptr = p; }
+
+        void drop() noexcept {}
+
+        T* m_ptr = nullptr;
+    };
+
+    template<class T>
+    struct generator_storage<T, by_value> {
+        template<class U>
+        void put(U&& u) {
+            m_ptr = new (&m_value) T(std::forward<U>(u));
+        }
+
+        void drop() noexcept {
+            if constexpr (!std::is_trivially_destructible_v<T>)
+                m_ptr->~T();
+        }
+
+        T* m_ptr = nullptr;
+        manual_lifetime<T> m_value;
+    };
+} // namespace coz::detail
+
+namespace coz {
+    template<class T, class Policy = by_value>
+    struct generator_promise : private detail::generator_storage<T, Policy> {
+        using element_type = T;
+
+        explicit generator_promise(
+            default_init<generator_promise>) noexcept {}
+
+        // Only valid before started.
+        generator_promise(generator_promise&&) noexcept {}
+
+        void finalize() noexcept { this->m_ptr = nullptr; }
+
+        template<class U = T>
+            requires std::is_same_v<Policy, by_value>
+        void yield_value(U&& u) {
+            this->put(std::forward<U>(u));
+        }
+
+        void yield_value(T& t) noexcept
+            requires std::is_same_v<Policy, by_reference>
+        {
+            this->put(std::addressof(t));
+        }
+
+        // A temporary would be gone before the consumer sees it, it can be
+        // kept in the frame via COZ_YIELD_KEEP instead.
+        template<class U>
+            requires std::is_same_v<Policy, by_reference> &&
+                     (!std::is_lvalue_reference_v<U>)
+        void yield_value(U&&) = delete;
+
+        void yield_value(T* p) noexcept
+            requires std::is_same_v<Policy, by_pointer>
+        {
+            this->put(p);
+        }
+
+        // Called by COZ_YIELD_KEEP until the range is exhausted.
+        template<class R>
+        bool yield_next(elements_of<R>& e) {
+            if (e.m_it) {
+                ++*e.m_it;
+            } else {
+                e.m_it.emplace(std::ranges::begin(e.range));
+                e.m_end.emplace(std::ranges::end(e.range));
+            }
+            if (*e.m_it == *e.m_end)
+                return false;
+            if constexpr (std::is_same_v<Policy, by_reference>) {
+                this->put(std::addressof(**e.m_it));
+            } else {
+                this->put(**e.m_it);
+            }
+            return true;
+        }
+
+        void return_void() noexcept {}
+
+#if !defined(COZ_NO_EXCEPTIONS)
+        void unhandled_exception() { throw; }
+#endif
+
+    private:
+        template<class T2, class Policy2, class Params, class State>
+        friend struct generator_range;
+
+        // Release the current value and produce the next one.
+        template<class Coro>
+        void advance(Coro& coro) {
+            this->drop();
+            coro.resume();
+        }
+    };
+
+    template<class T, class Policy, class Params, class State>
+    struct [[nodiscard]] generator_range : std::ranges::view_base {
+        using promise_type = generator_promise<T, Policy>;
+
+        explicit generator_range(Params&& params)
+            : generator_range(default_init<promise_type>{},
+                              std::move(params)) {}
+
+        template<class Init>
+        generator_range(Init&& init, Params&& params)
+            : m_coro(std::forward<Init>(init)), m_params(std::move(params)) {}
+
+        // Only valid before started.
+        generator_range(generator_range&&) = default;
+        generator_range& operator=(generator_range&&) = default;
+
+        ~generator_range() {
+            if (!m_coro.done()) {
+                m_coro.promise().drop();
+                m_coro.destroy();
+            }
+        }
+
+        struct iterator {
+            using element_type = typename promise_type::element_type;
+            using iterator_concept = std::input_iterator_tag;
+            using value_type = std::remove_cv_t<element_type>;
+            using difference_type = std::ptrdiff_t;
+            using reference = element_type&;
+
+            bool operator==(std::default_sentinel_t) const noexcept {
+                return m_ptr == nullptr;
+            }
+
+            iterator& operator++() {
+                m_coro->promise().advance(*m_coro);
+                m_ptr = m_coro->promise().m_ptr;
+                return *this;
+            }
+
+            void operator++(int) { ++*this; }
+
+            reference operator*() const noexcept { return *m_ptr; }
+
+            coroutine<promise_type, Params, State>* m_coro;
+            // The current value, cached so that dereferencing doesn't go
+            // through the promise.
+            element_type* m_ptr;
+        };
+
+        // Start the generator, which can only be called once.
+        iterator begin() {
+            m_coro.start(std::move(m_params));
+            return iterator{&m_coro, m_coro.promise().m_ptr};
+        }
+
+        std::default_sentinel_t end() const noexcept { return {}; }
+
+    private:
+        coroutine<promise_type, Params, State> m_coro;
+        Params m_params;
+    };
+
+    template<class T, class Policy = by_value>
+    constexpr default_init<generator_promise<T, Policy>> generator{};
+
+    template<class T, class Policy, class Params, class State>
+    struct co_result<default_init<generator_promise<T, Policy>>, Params,
+                     State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<generator_promise<T, Policy>> m_init;
+        Params m_params;
+
+        generator_range<T, Policy, Params, State> get_return_object() {
+            return generator_range<T, Policy, Params, State>(
+                std::move(m_params));
+        }
+    };
+
+    // The values are buffered in the promise, and the coroutine only suspends
+    // when the buffer is full, so the consumer gets them as spans. T must be
+    // default constructible and assignable, the values are assigned to the
+    // elements of the buffer.
+    template<class T, std::size_t N>
+    struct chunked_generator_promise {
+        static_assert(N > 0);
+
+        explicit chunked_generator_promise(
+            default_init<chunked_generator_promise>) noexcept {}
+
+        // Only valid before started.
+        chunked_generator_promise(chunked_generator_promise&&) noexcept {}
+
+        void finalize() noexcept {}
+
+        // Suspend when the buffer is full.
+        template<class U = T>
+        bool yield_value(U&& u) {
+            *m_pos = std::forward<U>(u);
+            return ++m_pos == m_buf.data() + N;
+        }
+
+        void return_void() noexcept {}
+
+#if !defined(COZ_NO_EXCEPTIONS)
+        void unhandled_exception() { throw; }
+#endif
+
+        std::span<T> chunk() noexcept { return {m_buf.data(), m_pos}; }
+
+        bool empty() const noexcept { return m_pos == m_buf.data(); }
+
+        void clear() noexcept { m_pos = m_buf.data(); }
+
+        std::array<T, N> m_buf;
+        // The end of the buffered values. Unlike an index, it can't alias the
+        // values (unless T is a character type), so the compiler keeps it in
+        // a register while the body fills the buffer.
+        T* m_pos = m_buf.data();
+    };
+
+    template<class T, std::size_t N, class Params, class State>
+    struct [[nodiscard]] chunked_generator_range : std::ranges::view_base {
+        using promise_type = chunked_generator_promise<T, N>;
+
+        explicit chunked_generator_range(Params&& params)
+            : m_coro(default_init<promise_type>{}),
+              m_params(std::move(params)) {}
+
+        // Only valid before started.
+        chunked_generator_range(chunked_generator_range&&) = default;
+        chunked_generator_range&
+        operator=(chunked_generator_range&&) = default;
+
+        ~chunked_generator_range() {
+            if (!m_coro.done())
+                m_coro.destroy();
+        }
+
+        struct iterator {
+            using iterator_concept = std::input_iterator_tag;
+            using value_type = std::span<T>;
+            using difference_type = std::ptrdiff_t;
+            using reference = std::span<T>;
+
+            // The last chunk is delivered after the coroutine is done, so
+            // it ends when there's nothing buffered.
+            bool operator==(std::default_sentinel_t) const noexcept {
+                return m_coro->promise().empty();
+            }
+
+            iterator& operator++() {
+                m_coro->promise().clear();
+                if (!m_coro->done())
+                    m_coro->resume();
+                return *this;
+            }
+
+            void operator++(int) { ++*this; }
+
+            std::span<T> operator*() const noexcept {
+                return m_coro->promise().chunk();
+            }
+
+            coroutine<promise_type, Params, State>* m_coro;
+        };
+
+        // Start the generator, which can only be called once.
+        iterator begin() {
+            m_coro.start(std::move(m_params));
+            return iterator{&m_coro};
+        }
+
+        std::default_sentinel_t end() const noexcept { return {}; }
+
+    private:
+        coroutine<promise_type, Params, State> m_coro;
+        Params m_params;
+    };
+
+    template<class T, std::size_t N>
+    constexpr default_init<chunked_generator_promise<T, N>>
+        chunked_generator{};
+
+    template<class T, std::size_t N, class Params, class State>
+    struct co_result<default_init<chunked_generator_promise<T, N>>, Params,
+                     State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<chunked_generator_promise<T, N>>
+            m_init;
+        Params m_params;
+
+        chunked_generator_range<T, N, Params, State> get_return_object() {
+            return chunked_generator_range<T, N, Params, State>(
+                std::move(m_params));
+        }
+    };
+} // namespace coz
+
+#endif
@@ -0,0 +1,143 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_INPLACE_TASK_HPP
+#define COZ_INPLACE_TASK_HPP
+
+#include <new>
+#include <cstddef>
+#include <coz/coroutine.hpp>
+
+namespace coz::detail {
+    // The coroutine with its params, kept until started.
+    template<class Promise, class Params, class State>
+    struct inplace_frame {
+        template<class Init>
+        inplace_frame(Init&& init, Params&& params)
+            : m_coro(std::forward<Init>(init)), m_params(std::move(params)) {}
+
+        coroutine<Promise, Params, State> m_coro;
+        Params m_params;
+    };
+
+    struct inplace_ops {
+        void (*m_start)(void* frame);
+        void (*m_relocate)(void* dst, void* src) noexcept;
+        void (*m_drop)(void* frame) noexcept;
+        coro_proto* (*m_proto)(void* frame) noexcept;
+    };
+
+    template<class Frame>
+    struct inplace_ops_for {
+        static void start(void* frame) {
+            auto f = static_cast<Frame*>(frame);
+            f->m_coro.start(std::move(f->m_params));
+        }
+
+        static void relocate(void* dst, void* src) noexcept {
+            auto f = static_cast<Frame*>(src);
+            new (dst) Frame(std::move(*f));
+            f->~Frame();
+        }
+
+        static void drop(void* frame) noexcept {
+            auto f = static_cast<Frame*>(frame);
+            if (!f->m_coro.done())
+                f->m_coro.destroy();
+            f->~Frame();
+        }
+
+        static coro_proto* proto(void* frame) noexcept {
+            return static_cast<coro_proto*>(
+                static_cast<Frame*>(frame)->m_coro.handle().address());
+        }
+
+        static constexpr inplace_ops value{start, relocate, drop, proto};
+    };
+} // namespace coz::detail
+
+namespace coz {
+    // Type-erased coroutine stored in a buffer of N bytes, no allocation.
+    template<class Promise, std::size_t N,
+             std::size_t Align = alignof(std::max_align_t)>
+    struct inplace_task {
+        inplace_task() noexcept = default;
+
+        // Construct coroutine<Promise, Params, State> in place, it's started
+        // by 'start'. Usually called in 'co_result::get_return_object'.
+        template<class State, class Init, class Params>
+        inplace_task(std::in_place_type_t<State>, Init&& init, Params&& params)
+            : m_ops(&detail::inplace_ops_for<frame_t<Params, State>>::value) {
+            using frame = frame_t<Params, State>;
+            static_assert(sizeof(frame) <= N,
+                          "the coroutine doesn't fit in the inplace_task");
+            static_assert(alignof(frame) <= Align,
+                          "the coroutine is overaligned for the inplace_task");
+            new (m_data) frame(std::forward<Init>(init), std::move(params));
+        }
+
+        // The coroutine is relocated, see 'coroutine::relocatable'.
+        inplace_task(inplace_task&& other) noexcept : m_ops(other.m_ops) {
+            if (m_ops) {
+                m_ops->m_relocate(m_data, other.m_data);
+                other.m_ops = nullptr;
+            }
+        }
+
+        inplace_task& operator=(inplace_task&& other) noexcept {
+            if (this != &other) {
+                reset();
+                if ((m_ops = other.m_ops)) {
+                    m_ops->m_relocate(m_data, other.m_data);
+                    other.m_ops = nullptr;
+                }
+            }
+            return *this;
+        }
+
+        ~inplace_task() { reset(); }
+
+        // Whether it holds a coroutine.
+        explicit operator bool() const noexcept { return m_ops != nullptr; }
+
+        coroutine_handle<Promise> handle() const noexcept {
+            return coroutine_handle<Promise>::from_address(proto());
+        }
+
+        Promise& promise() const noexcept { return handle().promise(); }
+
+        bool done() const noexcept { return detail::is_done(proto()); }
+
+        void start() { m_ops->m_start(m_data); }
+
+        void resume() const { handle().resume(); }
+
+        // The coroutine is done afterwards, so 'reset' doesn't destroy it
+        // again.
+        void destroy() const { handle().destroy(); }
+
+        // Destroy the coroutine if it's suspended, and release it.
+        void reset() noexcept {
+            if (m_ops) {
+                m_ops->m_drop(m_data);
+                m_ops = nullptr;
+            }
+        }
+
+    private:
+        template<class Params, class State>
+        using frame_t = detail::inplace_frame<Promise, Params, State>;
+
+        detail::coro_proto* proto() const noexcept {
+            return m_ops->m_proto(const_cast<std::byte*>(m_data));
+        }
+
+        const detail::inplace_ops* m_ops = nullptr;
+        alignas(Align) std::byte m_data[N];
+    };
+} // namespace coz
+
+#endif
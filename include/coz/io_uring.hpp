@@ -0,0 +1,451 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_IO_URING_HPP
+#define COZ_IO_URING_HPP
+
+#include <atomic>
+#include <chrono>
+#include <cerrno>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <cstdlib>
+#include <cstring>
+#include <memory>
+#include <utility>
+#include <system_error>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/socket.h>
+#include <sys/syscall.h>
+#include <linux/io_uring.h>
+#include <coz/coroutine.hpp>
+
+namespace coz::detail {
+    // The completion state of an operation, which lives in its awaiter, so
+    // the SQE points to it via 'user_data'.
+    struct uring_op {
+        coroutine_handle<> m_coro;
+        // In the list of the completed operations, see 'cancel'.
+        uring_op* m_next = nullptr;
+        int m_res = 0;
+        bool m_done = false;
+    };
+
+    [[noreturn]] inline void throw_errno(int err, const char* what) {
+#if defined(COZ_NO_EXCEPTIONS)
+        (void)err;
+        (void)what;
+        std::abort();
+#else
+        throw std::system_error(err, std::system_category(), what);
+#endif
+    }
+
+    template<class T>
+    T* uring_ptr(void* base, std::uint32_t off) noexcept {
+        return reinterpret_cast<T*>(static_cast<std::byte*>(base) + off);
+    }
+} // namespace coz::detail
+
+namespace coz {
+    // Proactor on io_uring, using the syscalls directly. The state of each
+    // operation lives in its awaiter, which is stored in the temporary memory
+    // of the awaiting coroutine, so the I/O path never allocates.
+    // Not thread-safe, 'run' and the operations must be called from the same
+    // thread.
+    struct io_uring_context {
+        explicit io_uring_context(unsigned entries = 256) {
+            io_uring_params params{};
+            params.flags =
+                IORING_SETUP_SINGLE_ISSUER | IORING_SETUP_DEFER_TASKRUN;
+            m_fd = setup(entries, params);
+            if (m_fd < 0 && errno == EINVAL) {
+                // Before Linux 6.1.
+                params = {};
+                m_fd = setup(entries, params);
+            }
+            if (m_fd < 0)
+                detail::throw_errno(errno, "io_uring_setup");
+            if (!(params.features & IORING_FEAT_SINGLE_MMAP) ||
+                !(params.features & IORING_FEAT_NODROP)) {
+                close();
+                detail::throw_errno(EOPNOTSUPP, "io_uring_setup");
+            }
+            m_defer_taskrun = params.flags & IORING_SETUP_DEFER_TASKRUN;
+
+            const std::size_t sq_size =
+                params.sq_off.array + params.sq_entries * sizeof(unsigned);
+            const std::size_t cq_size =
+                params.cq_off.cqes + params.cq_entries * sizeof(io_uring_cqe);
+            m_ring_size = sq_size > cq_size ? sq_size : cq_size;
+            m_ring = map(m_ring_size, IORING_OFF_SQ_RING);
+            if (!m_ring) {
+                const int err = errno;
+                close();
+                detail::throw_errno(err, "mmap");
+            }
+            m_sqes_size = params.sq_entries * sizeof(io_uring_sqe);
+            m_sqes = static_cast<io_uring_sqe*>(
+                map(m_sqes_size, IORING_OFF_SQES));
+            if (!m_sqes) {
+                const int err = errno;
+                close();
+                detail::throw_errno(err, "mmap");
+            }
+
+            m_sq_head = detail::uring_ptr<unsigned>(m_ring, params.sq_off.head);
+            m_sq_tail = detail::uring_ptr<unsigned>(m_ring, params.sq_off.tail);
+            m_sq_mask = *detail::uring_ptr<unsigned>(m_ring,
+                                                     params.sq_off.ring_mask);
+            m_sq_entries = params.sq_entries;
+            // The SQEs are used in order, so the indirection is the identity.
+            unsigned* array =
+                detail::uring_ptr<unsigned>(m_ring, params.sq_off.array);
+            for (unsigned i = 0; i != m_sq_entries; ++i)
+                array[i] = i;
+            m_cq_head = detail::uring_ptr<unsigned>(m_ring, params.cq_off.head);
+            m_cq_tail = detail::uring_ptr<unsigned>(m_ring, params.cq_off.tail);
+            m_cq_mask = *detail::uring_ptr<unsigned>(m_ring,
+                                                     params.cq_off.ring_mask);
+            m_cqes = detail::uring_ptr<io_uring_cqe>(m_ring,
+                                                     params.cq_off.cqes);
+        }
+
+        io_uring_context(const io_uring_context&) = delete;
+        io_uring_context& operator=(const io_uring_context&) = delete;
+
+        // The coroutines waiting on it must have been destroyed.
+        ~io_uring_context() {
+            assert(m_pending == 0 && !m_ready);
+            close();
+        }
+
+        // The awaiter of an operation, its result is that of the syscall,
+        // i.e. a negative errno on failure.
+        struct [[nodiscard]] operation : private detail::uring_op {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                m_ctx->submit(*this);
+            }
+
+            int await_resume() const noexcept { return m_res; }
+
+            // The coroutine is destroyed, wait until the kernel no longer
+            // refers to the awaiter.
+            void await_cancel() noexcept { m_ctx->cancel(*this); }
+
+        private:
+            friend io_uring_context;
+
+            operation(io_uring_context* ctx, std::uint8_t opcode, int fd,
+                      std::uint64_t addr, std::uint32_t len,
+                      std::uint64_t off, std::uint32_t op_flags) noexcept
+                : m_ctx(ctx), m_addr(addr), m_off(off), m_fd(fd), m_len(len),
+                  m_op_flags(op_flags), m_opcode(opcode) {}
+
+            io_uring_context* m_ctx;
+            std::uint64_t m_addr;
+            std::uint64_t m_off;
+            int m_fd;
+            std::uint32_t m_len;
+            std::uint32_t m_op_flags;
+            std::uint8_t m_opcode;
+        };
+
+        // Completes without doing anything, e.g. to measure the overhead.
+        operation nop() noexcept {
+            return {this, IORING_OP_NOP, -1, 0, 0, 0, 0};
+        }
+
+        // 'offset' of -1 means the current file position.
+        operation read(int fd, void* buf, std::uint32_t len,
+                       std::uint64_t offset = std::uint64_t(-1)) noexcept {
+            return {this, IORING_OP_READ, fd, addr_of(buf), len, offset, 0};
+        }
+
+        operation write(int fd, const void* buf, std::uint32_t len,
+                        std::uint64_t offset = std::uint64_t(-1)) noexcept {
+            return {this, IORING_OP_WRITE, fd, addr_of(buf), len, offset, 0};
+        }
+
+        operation recv(int fd, void* buf, std::uint32_t len,
+                       int flags = 0) noexcept {
+            return {this,         IORING_OP_RECV, fd, addr_of(buf), len, 0,
+                    std::uint32_t(flags)};
+        }
+
+        operation send(int fd, const void* buf, std::uint32_t len,
+                       int flags = 0) noexcept {
+            return {this,         IORING_OP_SEND, fd, addr_of(buf), len, 0,
+                    std::uint32_t(flags)};
+        }
+
+        // The result is the accepted socket.
+        operation accept(int fd, sockaddr* addr = nullptr,
+                         socklen_t* addrlen = nullptr,
+                         int flags = 0) noexcept {
+            return {this, IORING_OP_ACCEPT,  fd, addr_of(addr), 0,
+                    addr_of(addrlen), std::uint32_t(flags)};
+        }
+
+        operation connect(int fd, const sockaddr* addr,
+                          socklen_t addrlen) noexcept {
+            return {this, IORING_OP_CONNECT, fd, addr_of(addr), 0, addrlen, 0};
+        }
+
+        // Resume the coroutines until there's no pending operation, returns
+        // the number of resumptions.
+        std::size_t run() {
+            std::size_t n = 0;
+            while (dispatch_one(-1))
+                ++n;
+            return n;
+        }
+
+        // Resume at most one coroutine, waits if there's a pending operation.
+        bool run_one() { return dispatch_one(-1); }
+
+        // Like 'run_one', but waits at most 'timeout', even if no operation
+        // is pending, e.g. for the next timer.
+        bool run_one_for(std::chrono::nanoseconds timeout) {
+            return dispatch_one(timeout.count() > 0 ? timeout.count() : 0);
+        }
+
+        // Like 'run', but doesn't wait.
+        std::size_t poll() {
+            std::size_t n = 0;
+            while (dispatch_one(0))
+                ++n;
+            return n;
+        }
+
+        // The number of operations that are not yet completed.
+        std::size_t pending() const noexcept { return m_pending; }
+
+    private:
+        static int setup(unsigned entries, io_uring_params& params) noexcept {
+            return int(::syscall(__NR_io_uring_setup, entries, &params));
+        }
+
+        template<class T>
+        static std::uint64_t addr_of(T* p) noexcept {
+            return reinterpret_cast<std::uintptr_t>(p);
+        }
+
+        void* map(std::size_t size, off_t offset) noexcept {
+            void* p = ::mmap(nullptr, size, PROT_READ | PROT_WRITE,
+                             MAP_SHARED | MAP_POPULATE, m_fd, offset);
+            return p == MAP_FAILED ? nullptr : p;
+        }
+
+        void close() noexcept {
+            if (m_sqes)
+                ::munmap(m_sqes, m_sqes_size);
+            if (m_ring)
+                ::munmap(m_ring, m_ring_size);
+            ::close(m_fd);
+        }
+
+        // Submit the queued SQEs, and wait for 'min_complete' CQEs.
+        void enter(unsigned min_complete) {
+            const unsigned to_submit = m_sqe_tail - m_submitted;
+            unsigned flags = 0;
+            if (min_complete || m_defer_taskrun)
+                flags |= IORING_ENTER_GETEVENTS;
+            const int n = int(::syscall(__NR_io_uring_enter, m_fd, to_submit,
+                                        min_complete, flags, nullptr, 0));
+            if (n < 0) {
+                // Interrupted, or the CQ ring has to be reaped first.
+                if (errno == EINTR || errno == EAGAIN || errno == EBUSY)
+                    return;
+                detail::throw_errno(errno, "io_uring_enter");
+            }
+            m_submitted += unsigned(n);
+        }
+
+        io_uring_sqe* get_sqe() {
+            while (m_sqe_tail - std::atomic_ref(*m_sq_head).load(
+                                    std::memory_order_acquire) ==
+                   m_sq_entries)
+                enter(0);
+            io_uring_sqe* sqe = &m_sqes[m_sqe_tail & m_sq_mask];
+            ++m_sqe_tail;
+            std::memset(sqe, 0, sizeof(io_uring_sqe));
+            std::atomic_ref(*m_sq_tail).store(m_sqe_tail,
+                                              std::memory_order_release);
+            return sqe;
+        }
+
+        void submit(operation& op) {
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = op.m_opcode;
+            sqe->fd = op.m_fd;
+            sqe->addr = op.m_addr;
+            sqe->off = op.m_off;
+            sqe->len = op.m_len;
+            sqe->rw_flags = int(op.m_op_flags);
+            sqe->user_data =
+                addr_of(static_cast<detail::uring_op*>(std::addressof(op)));
+            ++m_pending;
+        }
+
+        // Returns the next completed operation, if any. The CQEs of the
+        // cancel requests, whose 'user_data' is 0, and those of the timeouts
+        // are skipped.
+        detail::uring_op* reap() noexcept {
+            const unsigned tail =
+                std::atomic_ref(*m_cq_tail).load(std::memory_order_acquire);
+            for (unsigned head = *m_cq_head; head != tail;) {
+                const io_uring_cqe& cqe = m_cqes[head & m_cq_mask];
+                const std::uint64_t user_data = cqe.user_data;
+                const int res = cqe.res;
+                std::atomic_ref(*m_cq_head).store(++head,
+                                                  std::memory_order_release);
+                if (user_data & 1) {
+                    // Expired or removed, see 'add_timeout'.
+                    if (user_data == m_timeout_data)
+                        m_timeout_data = 0;
+                } else if (user_data) {
+                    auto op = reinterpret_cast<detail::uring_op*>(user_data);
+                    op->m_res = res;
+                    --m_pending;
+                    return op;
+                }
+            }
+            return nullptr;
+        }
+
+        // Waits at most 'timeout' ns, or indefinitely if negative.
+        bool dispatch_one(std::int64_t timeout) {
+            for (bool entered = false;; entered = true) {
+                if (detail::uring_op* op = m_ready) {
+                    m_ready = std::exchange(op->m_next, nullptr);
+                    if (!m_ready)
+                        m_ready_tail = nullptr;
+                    op->m_coro.resume();
+                    return true;
+                }
+                if (detail::uring_op* op = reap()) {
+                    remove_timeout();
+                    op->m_coro.resume();
+                    return true;
+                }
+                // The skipped CQEs may wake it before the timeout expires.
+                if ((m_pending == 0 && timeout < 0) ||
+                    (entered && (timeout == 0 || !m_timeout_data))) {
+                    remove_timeout();
+                    return false;
+                }
+                if (timeout > 0) {
+                    if (!entered)
+                        add_timeout(timeout);
+                    enter(1);
+                } else {
+                    enter(timeout < 0 ? 1 : 0);
+                }
+            }
+        }
+
+        // The timespec is kept in the context, as the SQE may only be
+        // submitted by a later 'enter', e.g. if this one is interrupted. The
+        // 'user_data' is odd, so it can't be that of an operation, and tells
+        // the timeouts apart.
+        void add_timeout(std::int64_t ns) {
+            m_timeout_ts = {ns / 1000000000, ns % 1000000000};
+            m_timeout_data = (++m_timeout_gen << 1) | 1;
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_TIMEOUT;
+            sqe->fd = -1;
+            sqe->addr = addr_of(&m_timeout_ts);
+            sqe->len = 1;
+            sqe->user_data = m_timeout_data;
+        }
+
+        // Remove the timeout that didn't expire, if any, so they don't pile
+        // up in the kernel. The request is submitted by the next 'enter'.
+        void remove_timeout() {
+            if (!m_timeout_data)
+                return;
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_TIMEOUT_REMOVE;
+            sqe->fd = -1;
+            sqe->addr = std::exchange(m_timeout_data, 0);
+        }
+
+        void push_ready(detail::uring_op* op) noexcept {
+            op->m_done = true;
+            if (m_ready_tail) {
+                m_ready_tail->m_next = op;
+            } else {
+                m_ready = op;
+            }
+            m_ready_tail = op;
+        }
+
+        void erase_ready(detail::uring_op* op) noexcept {
+            detail::uring_op* prev = nullptr;
+            for (detail::uring_op* it = m_ready; it != op;
+                 prev = it, it = it->m_next)
+                assert(it);
+            (prev ? prev->m_next : m_ready) = op->m_next;
+            if (m_ready_tail == op)
+                m_ready_tail = prev;
+            op->m_next = nullptr;
+        }
+
+        // Request the cancellation and wait for the CQE of the operation.
+        // The operations completed meanwhile are resumed later by 'run'.
+        void cancel(detail::uring_op& op) noexcept {
+            if (op.m_done) {
+                erase_ready(&op);
+                return;
+            }
+            io_uring_sqe* sqe = get_sqe();
+            sqe->opcode = IORING_OP_ASYNC_CANCEL;
+            sqe->fd = -1;
+            sqe->addr = addr_of(&op);
+            for (;;) {
+                while (detail::uring_op* p = reap()) {
+                    if (p == &op)
+                        return;
+                    push_ready(p);
+                }
+                enter(1);
+            }
+        }
+
+        int m_fd = -1;
+        bool m_defer_taskrun = false;
+        void* m_ring = nullptr;
+        std::size_t m_ring_size = 0;
+        io_uring_sqe* m_sqes = nullptr;
+        std::size_t m_sqes_size = 0;
+        unsigned* m_sq_head = nullptr;
+        unsigned* m_sq_tail = nullptr;
+        unsigned m_sq_mask = 0;
+        unsigned m_sq_entries = 0;
+        // The local copy of the tail, and how many SQEs were submitted.
+        unsigned m_sqe_tail = 0;
+        unsigned m_submitted = 0;
+        unsigned* m_cq_head = nullptr;
+        unsigned* m_cq_tail = nullptr;
+        unsigned m_cq_mask = 0;
+        io_uring_cqe* m_cqes = nullptr;
+        std::size_t m_pending = 0;
+        detail::uring_op* m_ready = nullptr;
+        detail::uring_op* m_ready_tail = nullptr;
+        __kernel_timespec m_timeout_ts{};
+        // The 'user_data' of the armed timeout, or 0.
+        std::uint64_t m_timeout_data = 0;
+        std::uint64_t m_timeout_gen = 0;
+    };
+} // namespace coz
+
+#endif
@@ -0,0 +1,182 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_RECURSIVE_TASK_HPP
+#define COZ_RECURSIVE_TASK_HPP
+
+#include <new>
+#include <span>
+#include <cstddef>
+#include <cstdlib>
+#include <coz/task.hpp>
+#include <coz/inplace_task.hpp>
+
+namespace coz {
+    // Stack-like memory for the frames of recursive tasks, the last pushed
+    // frame must be popped first.
+    struct frame_arena {
+        explicit frame_arena(std::span<std::byte> buf) noexcept
+            : m_top(buf.data()), m_beg(buf.data()),
+              m_end(buf.data() + buf.size()) {}
+
+        frame_arena(const frame_arena&) = delete;
+        frame_arena& operator=(const frame_arena&) = delete;
+
+        void* push(std::size_t size, std::size_t align) {
+            const auto top = reinterpret_cast<std::uintptr_t>(m_top);
+            const auto p = reinterpret_cast<std::byte*>(
+                detail::align_up(top, align));
+            if (size > std::size_t(m_end - p)) [[unlikely]] {
+#if defined(COZ_NO_EXCEPTIONS)
+                std::abort();
+#else
+                throw std::bad_alloc();
+#endif
+            }
+            m_top = p + size;
+            return p;
+        }
+
+        void pop(void* p) noexcept {
+            assert(p >= m_beg && p < m_top);
+            m_top = static_cast<std::byte*>(p);
+        }
+
+        std::size_t used() const noexcept { return m_top - m_beg; }
+
+    private:
+        std::byte* m_top;
+        std::byte* m_beg;
+        std::byte* m_end;
+    };
+
+    template<class T>
+    struct recursive_promise;
+
+    // The promise-initializer of recursive tasks.
+    template<class T = void>
+    struct recursive {
+        using promise_type = recursive_promise<T>;
+
+        explicit recursive(frame_arena& arena) noexcept : m_arena(&arena) {}
+
+        frame_arena* m_arena;
+    };
+
+    template<class T>
+    struct recursive_promise : detail::task_promise_base<T> {
+        explicit recursive_promise(recursive<T>) noexcept {}
+    };
+} // namespace coz
+
+namespace coz::detail {
+    struct recursive_ops {
+        void (*m_prepare)(void* frame);
+        void (*m_drop)(void* frame) noexcept;
+    };
+
+    template<class Frame>
+    struct recursive_ops_for {
+        static void prepare(void* frame) {
+            auto f = static_cast<Frame*>(frame);
+            f->m_coro.prepare(std::move(f->m_params));
+        }
+
+        static void drop(void* frame) noexcept {
+            static_cast<Frame*>(frame)->~Frame();
+        }
+
+        static constexpr recursive_ops value{prepare, drop};
+    };
+} // namespace coz::detail
+
+namespace coz {
+    // Like 'task', but the frame of the child is pushed to the arena, so the
+    // type doesn't depend on the coroutine and it can await itself. The
+    // function must declare it as the return type.
+    template<class T = void>
+    struct [[nodiscard]] recursive_task {
+        using promise_type = recursive_promise<T>;
+
+        template<class Params, class State>
+        recursive_task(frame_arena& arena, Params&& params,
+                       std::type_identity<State>)
+            : m_arena(&arena),
+              m_ops(&detail::recursive_ops_for<frame_t<Params, State>>::value) {
+            using frame = frame_t<Params, State>;
+            void* p = arena.push(sizeof(frame), alignof(frame));
+            auto f = new (p) frame(recursive<T>(arena), std::move(params));
+            m_frame = p;
+            m_coro = f->m_coro.handle();
+        }
+
+        recursive_task(recursive_task&& other) noexcept
+            : m_arena(other.m_arena), m_ops(other.m_ops),
+              m_frame(std::exchange(other.m_frame, nullptr)),
+              m_coro(other.m_coro) {}
+
+        recursive_task& operator=(recursive_task&&) = delete;
+
+        ~recursive_task() {
+            if (m_frame) {
+                if (!m_coro.done())
+                    m_coro.destroy();
+                m_ops->m_drop(m_frame);
+                m_arena->pop(m_frame);
+            }
+        }
+
+        bool await_ready() const noexcept { return false; }
+
+        template<class Promise>
+        coroutine_handle<> await_suspend(coroutine_handle<Promise> cont) {
+            m_coro.promise().await_from(cont);
+            m_ops->m_prepare(m_frame);
+            return m_coro;
+        }
+
+        T await_resume() { return m_coro.promise().get(); }
+
+        void await_cancel() noexcept {
+            m_coro.promise().m_cont = nullptr;
+            m_coro.destroy();
+        }
+
+        // Run it outside of coroutines, it's done unless it awaits something
+        // else than recursive tasks.
+        void start() {
+            m_ops->m_prepare(m_frame);
+            m_coro.resume();
+        }
+
+        bool done() const noexcept { return m_coro.done(); }
+
+        // The result after it's done.
+        T get() { return m_coro.promise().get(); }
+
+    private:
+        template<class Params, class State>
+        using frame_t = detail::inplace_frame<promise_type, Params, State>;
+
+        frame_arena* m_arena;
+        const detail::recursive_ops* m_ops;
+        void* m_frame;
+        coroutine_handle<promise_type> m_coro;
+    };
+
+    template<class T, class Params, class State>
+    struct co_result<recursive<T>, Params, State> {
+        recursive<T> m_init;
+        Params m_params;
+
+        recursive_task<T> get_return_object() {
+            return recursive_task<T>(*m_init.m_arena, std::move(m_params),
+                                     std::type_identity<State>{});
+        }
+    };
+} // namespace coz
+
+#endif
@@ -0,0 +1,350 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_SPSC_CHANNEL_HPP
+#define COZ_SPSC_CHANNEL_HPP
+
+#include <new>
+#include <atomic>
+#include <memory>
+#include <utility>
+#include <cstddef>
+#include <cassert>
+#include <algorithm>
+#include <type_traits>
+#include <coz/async_waiter.hpp>
+#include <coz/cache_line.hpp>
+
+namespace coz::detail {
+    // A side of 'spsc_channel' that waits, which lives in its awaiter.
+    struct spsc_parker : async_waiter {
+        // Resume it via the scheduler, or inline if null.
+        void* m_sched = nullptr;
+        void (*m_post)(void* sched, coroutine_handle<> coro) = nullptr;
+
+        void wake() {
+            if (m_post) {
+                m_post(m_sched, m_coro);
+            } else {
+                resume_waiter(this);
+            }
+        }
+    };
+
+    template<class Scheduler>
+    void spsc_post(void* sched, coroutine_handle<> coro) {
+        static_cast<Scheduler*>(sched)->post(coro);
+    }
+} // namespace coz::detail
+
+namespace coz {
+    // Bounded channel for exactly one producer and one consumer, e.g. two
+    // stages of a pipeline on different threads. Each side keeps its index
+    // and a cached copy of the other's on its own cache line, and publishes
+    // its index once per 'batch' values, so the sides rarely touch a shared
+    // line. A side that can't proceed publishes what it has, and parks in
+    // its slot, then the other side wakes it when it publishes, which is
+    // the only time a wakeup is paid for: via the 'post' of the scheduler
+    // of the parked coroutine (e.g. 'thread_pool', which wakes a sleeping
+    // worker through a futex), inline if none, or via a futex for a blocked
+    // thread.
+    //
+    // The sent values are visible to the consumer at the batch boundaries,
+    // when the producer waits, or on 'flush()', which the producer should
+    // call when it's done with a burst.
+    //
+    // A coroutine must not be destroyed while waiting on it.
+    template<class T, std::size_t N>
+    struct spsc_channel {
+        static_assert(N >= 2 && (N & (N - 1)) == 0,
+                      "N must be a power of 2, at least 2");
+        static_assert(std::is_nothrow_move_constructible_v<T>);
+
+        // The number of values between the publications of an index.
+        static constexpr std::size_t batch =
+            std::clamp<std::size_t>(N / 4, 1, 32);
+
+        spsc_channel() noexcept = default;
+
+        spsc_channel(const spsc_channel&) = delete;
+        spsc_channel& operator=(const spsc_channel&) = delete;
+
+        // The values left in the buffer are destroyed.
+        ~spsc_channel() {
+            assert(!m_consumer_slot.load(std::memory_order_relaxed) &&
+                   !m_producer_slot.load(std::memory_order_relaxed));
+            for (std::size_t i = m_cons.m_pos; i != m_prod.m_pos; ++i)
+                std::destroy_at(slot(i));
+        }
+
+        static constexpr std::size_t capacity() noexcept { return N; }
+
+        // Producer side. Moves from 'value' only on success.
+        bool try_send(T& value) {
+            if (m_prod.m_pos - m_prod.m_cache == N) {
+                m_prod.m_cache = m_head.load(std::memory_order_acquire);
+                if (m_prod.m_pos - m_prod.m_cache == N)
+                    return false;
+            }
+            ::new (m_buf[m_prod.m_pos & (N - 1)]) T(std::move(value));
+            ++m_prod.m_pos;
+            if (m_prod.m_pos - m_prod.m_published >= batch ||
+                m_consumer_slot.load(std::memory_order_relaxed))
+                flush();
+            return true;
+        }
+
+        // Producer side. Publish the values sent so far.
+        void flush() {
+            if (m_prod.m_published == m_prod.m_pos)
+                return;
+            m_prod.m_published = m_prod.m_pos;
+            m_tail.store(m_prod.m_pos, std::memory_order_release);
+            // Pairs with the store in 'park'.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake(m_consumer_slot);
+        }
+
+        // Consumer side.
+        bool try_receive(T& out) {
+            if (!readable())
+                return false;
+            T* p = slot(m_cons.m_pos);
+            out = std::move(*p);
+            pop(p);
+            return true;
+        }
+
+        template<class Scheduler>
+        struct [[nodiscard]] send_awaiter : private detail::spsc_parker {
+            bool await_ready() {
+                return m_done = m_chan->try_send(m_value);
+            }
+
+            bool await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                m_chan->flush();
+                return m_chan->park(m_chan->m_producer_slot, parker(),
+                                    &spsc_channel::writable);
+            }
+
+            void await_resume() {
+                if (!m_done) {
+                    [[maybe_unused]] const bool sent =
+                        m_chan->try_send(m_value);
+                    assert(sent);
+                }
+            }
+
+        private:
+            friend spsc_channel;
+
+            detail::spsc_parker* parker() noexcept { return this; }
+
+            send_awaiter(spsc_channel* chan, Scheduler* sched,
+                         T&& value) noexcept
+                : m_chan(chan), m_value(std::move(value)) {
+                if constexpr (!std::is_void_v<Scheduler>) {
+                    m_sched = sched;
+                    m_post = detail::spsc_post<Scheduler>;
+                }
+            }
+
+            spsc_channel* m_chan;
+            T m_value;
+            bool m_done = false;
+        };
+
+        template<class Scheduler>
+        struct [[nodiscard]] receive_awaiter : private detail::spsc_parker {
+            receive_awaiter(const receive_awaiter&) = delete;
+            receive_awaiter& operator=(const receive_awaiter&) = delete;
+
+            ~receive_awaiter() {
+                if (m_has_value)
+                    std::destroy_at(value());
+            }
+
+            bool await_ready() { return receive(); }
+
+            bool await_suspend(coroutine_handle<> coro) {
+                m_coro = coro;
+                m_chan->publish_head();
+                return m_chan->park(m_chan->m_consumer_slot, parker(),
+                                    &spsc_channel::readable);
+            }
+
+            T await_resume() {
+                if (!m_has_value) {
+                    [[maybe_unused]] const bool received = receive();
+                    assert(received);
+                }
+                return std::move(*value());
+            }
+
+        private:
+            friend spsc_channel;
+
+            detail::spsc_parker* parker() noexcept { return this; }
+
+            receive_awaiter(spsc_channel* chan, Scheduler* sched) noexcept
+                : m_chan(chan) {
+                if constexpr (!std::is_void_v<Scheduler>) {
+                    m_sched = sched;
+                    m_post = detail::spsc_post<Scheduler>;
+                }
+            }
+
+            bool receive() {
+                if (!m_chan->readable())
+                    return false;
+                T* p = m_chan->slot(m_chan->m_cons.m_pos);
+                ::new (m_storage) T(std::move(*p));
+                m_has_value = true;
+                m_chan->pop(p);
+                return true;
+            }
+
+            T* value() noexcept {
+                return std::launder(reinterpret_cast<T*>(m_storage));
+            }
+
+            spsc_channel* m_chan;
+            bool m_has_value = false;
+            alignas(T) unsigned char m_storage[sizeof(T)];
+        };
+
+        // The waiting consumer is resumed inline by the producer.
+        send_awaiter<void> send(T value) noexcept {
+            return {this, nullptr, std::move(value)};
+        }
+
+        // The waiting consumer is posted to its scheduler by the producer.
+        template<class Scheduler>
+        send_awaiter<Scheduler> send(T value, Scheduler& sched) noexcept {
+            return {this, &sched, std::move(value)};
+        }
+
+        receive_awaiter<void> receive() noexcept { return {this, nullptr}; }
+
+        template<class Scheduler>
+        receive_awaiter<Scheduler> receive(Scheduler& sched) noexcept {
+            return {this, &sched};
+        }
+
+        // Producer side, for a thread that isn't a coroutine. Blocks on a
+        // futex while full.
+        void send_blocking(T value) {
+            while (!try_send(value)) {
+                flush();
+                block(m_producer_slot, &spsc_channel::writable);
+            }
+        }
+
+        // Consumer side, for a thread that isn't a coroutine. Blocks on a
+        // futex while empty.
+        T receive_blocking() {
+            while (!readable()) {
+                publish_head();
+                block(m_consumer_slot, &spsc_channel::readable);
+            }
+            T* p = slot(m_cons.m_pos);
+            T value(std::move(*p));
+            pop(p);
+            return value;
+        }
+
+    private:
+        // In a slot for a blocked thread.
+        static inline char s_thread_marker;
+
+        struct alignas(detail::cache_line) side {
+            // The next position to write or read.
+            std::size_t m_pos = 0;
+            // The last position published.
+            std::size_t m_published = 0;
+            // The last position seen of the other side.
+            std::size_t m_cache = 0;
+        };
+
+        T* slot(std::size_t pos) noexcept {
+            return std::launder(reinterpret_cast<T*>(m_buf[pos & (N - 1)]));
+        }
+
+        bool writable() noexcept {
+            if (m_prod.m_pos - m_prod.m_cache != N)
+                return true;
+            m_prod.m_cache = m_head.load(std::memory_order_seq_cst);
+            return m_prod.m_pos - m_prod.m_cache != N;
+        }
+
+        bool readable() noexcept {
+            if (m_cons.m_pos != m_cons.m_cache)
+                return true;
+            m_cons.m_cache = m_tail.load(std::memory_order_seq_cst);
+            return m_cons.m_pos != m_cons.m_cache;
+        }
+
+        void pop(T* p) {
+            std::destroy_at(p);
+            ++m_cons.m_pos;
+            if (m_cons.m_pos - m_cons.m_published >= batch ||
+                m_producer_slot.load(std::memory_order_relaxed))
+                publish_head();
+        }
+
+        void publish_head() {
+            if (m_cons.m_published == m_cons.m_pos)
+                return;
+            m_cons.m_published = m_cons.m_pos;
+            m_head.store(m_cons.m_pos, std::memory_order_release);
+            // Pairs with the store in 'park'.
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            wake(m_producer_slot);
+        }
+
+        // Returns false if it needn't wait after all. Either this sees the
+        // index published by the other side, or the other side sees the
+        // slot after publishing.
+        bool park(std::atomic<void*>& slot, void* p,
+                  bool (spsc_channel::*ready)()) {
+            slot.store(p, std::memory_order_seq_cst);
+            if (!(this->*ready)())
+                return true;
+            // The other side may have taken it, then it will wake this.
+            return slot.exchange(nullptr, std::memory_order_acq_rel) != p;
+        }
+
+        void block(std::atomic<void*>& slot, bool (spsc_channel::*ready)()) {
+            if (!park(slot, &s_thread_marker, ready))
+                return;
+            slot.wait(&s_thread_marker, std::memory_order_acquire);
+        }
+
+        void wake(std::atomic<void*>& slot) {
+            if (!slot.load(std::memory_order_relaxed))
+                return;
+            void* p = slot.exchange(nullptr, std::memory_order_acq_rel);
+            if (p == &s_thread_marker) {
+                slot.notify_one();
+            } else if (p) {
+                static_cast<detail::spsc_parker*>(p)->wake();
+            }
+        }
+
+        side m_prod;
+        side m_cons;
+        alignas(detail::cache_line) std::atomic<std::size_t> m_tail{0};
+        alignas(detail::cache_line) std::atomic<std::size_t> m_head{0};
+        // The parked side, if any.
+        alignas(detail::cache_line) std::atomic<void*> m_consumer_slot{};
+        alignas(detail::cache_line) std::atomic<void*> m_producer_slot{};
+        alignas(detail::cache_line) alignas(T) unsigned char m_buf[N]
+                                                               [sizeof(T)];
+    };
+} // namespace coz
+
+#endif
@@ -0,0 +1,124 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_TASK_HPP
+#define COZ_TASK_HPP
+
+#include <optional>
+#include <coz/coroutine.hpp>
+#include <coz/cancellation.hpp>
+
+namespace coz::detail {
+    template<class T>
+    struct task_result {
+        template<class U = T>
+        void return_value(U&& u) {
+            m_value.emplace(std::forward<U>(u));
+        }
+
+        T get() { return std::move(*m_value); }
+
+        std::optional<T> m_value;
+    };
+
+    template<>
+    struct task_result<void> {
+        void return_void() noexcept {}
+
+        void get() noexcept {}
+    };
+
+    // The promise of the coroutines that are awaited by another one.
+    template<class T>
+    struct task_promise_base : task_result<T> {
+        // Resume the awaiting coroutine.
+        coroutine_handle<> finalize() noexcept { return m_cont; }
+
+        // That of the awaiting coroutine, so a stop request reaches the
+        // awaits of the child.
+        std::stop_token get_stop_token() const noexcept { return m_stop; }
+
+        template<class Promise>
+        void await_from(coroutine_handle<Promise> cont) noexcept {
+            m_cont = cont;
+            m_stop = coz::get_stop_token(cont);
+        }
+
+#if !defined(COZ_NO_EXCEPTIONS)
+        void unhandled_exception() noexcept {
+            m_exception = std::current_exception();
+        }
+#endif
+
+        T get() {
+#if !defined(COZ_NO_EXCEPTIONS)
+            if (m_exception)
+                std::rethrow_exception(std::move(m_exception));
+#endif
+            return task_result<T>::get();
+        }
+
+        coroutine_handle<> m_cont;
+        std::stop_token m_stop;
+#if !defined(COZ_NO_EXCEPTIONS)
+        std::exception_ptr m_exception;
+#endif
+    };
+} // namespace coz::detail
+
+namespace coz {
+    template<class T>
+    struct task_promise : detail::task_promise_base<T> {
+        explicit task_promise(default_init<task_promise>) noexcept {}
+    };
+
+    // The awaiter returned by a task, which contains the frame of the child,
+    // so it lives in the temporary memory of the awaiting coroutine.
+    template<class T, class Params, class State>
+    struct [[nodiscard]] task_awaiter {
+        using promise_type = task_promise<T>;
+
+        explicit task_awaiter(Params&& params)
+            : m_coro(default_init<promise_type>{}),
+              m_params(std::move(params)) {}
+
+        bool await_ready() const noexcept { return false; }
+
+        template<class Promise>
+        coroutine_handle<> await_suspend(coroutine_handle<Promise> cont) {
+            m_coro.promise().await_from(cont);
+            m_coro.prepare(std::move(m_params));
+            return m_coro.handle();
+        }
+
+        T await_resume() { return m_coro.promise().get(); }
+
+        // The awaiting coroutine is destroyed, so is the child.
+        void await_cancel() noexcept {
+            m_coro.promise().m_cont = nullptr;
+            m_coro.destroy();
+        }
+
+    private:
+        coroutine<promise_type, Params, State> m_coro;
+        Params m_params;
+    };
+
+    template<class T = void>
+    constexpr default_init<task_promise<T>> task{};
+
+    template<class T, class Params, class State>
+    struct co_result<default_init<task_promise<T>>, Params, State> {
+        COZ_NO_UNIQUE_ADDRESS default_init<task_promise<T>> m_init;
+        Params m_params;
+
+        task_awaiter<T, Params, State> get_return_object() {
+            return task_awaiter<T, Params, State>(std::move(m_params));
+        }
+    };
+} // namespace coz
+
+#endif
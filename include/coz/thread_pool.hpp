@@ -0,0 +1,419 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_THREAD_POOL_HPP
+#define COZ_THREAD_POOL_HPP
+
+#include <atomic>
+#include <utility>
+#include <thread>
+#include <vector>
+#include <cstdint>
+#include <cstddef>
+#include <coz/coroutine.hpp>
+#include <coz/cache_line.hpp>
+
+namespace coz::detail {
+    // Chase-Lev deque with a fixed capacity, as described in "Correct and
+    // Efficient Work-Stealing for Weak Memory Models" (Lê et al., 2013).
+    // The owner pushes and pops at the bottom, the thieves steal from the top.
+    template<std::size_t N>
+    struct ws_deque {
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+        // Owner only, returns false if full.
+        bool push(coro_proto* p) noexcept {
+            const std::int64_t b = m_bottom.load(std::memory_order_relaxed);
+            const std::int64_t t = m_top.load(std::memory_order_acquire);
+            if (b - t >= std::int64_t(N))
+                return false;
+            m_buf[b & (N - 1)].store(p, std::memory_order_relaxed);
+            m_bottom.store(b + 1, std::memory_order_release);
+            return true;
+        }
+
+        // Owner only.
+        coro_proto* pop() noexcept {
+            const std::int64_t b = m_bottom.load(std::memory_order_relaxed) - 1;
+            m_bottom.store(b, std::memory_order_relaxed);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            std::int64_t t = m_top.load(std::memory_order_relaxed);
+            if (t > b) {
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+                return nullptr;
+            }
+            coro_proto* p = m_buf[b & (N - 1)].load(std::memory_order_relaxed);
+            if (t == b) {
+                // The last one, race against the thieves.
+                if (!m_top.compare_exchange_strong(t, t + 1,
+                                                   std::memory_order_seq_cst,
+                                                   std::memory_order_relaxed))
+                    p = nullptr;
+                m_bottom.store(b + 1, std::memory_order_relaxed);
+            }
+            return p;
+        }
+
+        // Any thread, returns null if empty or lost the race.
+        coro_proto* steal() noexcept {
+            std::int64_t t = m_top.load(std::memory_order_acquire);
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            const std::int64_t b = m_bottom.load(std::memory_order_acquire);
+            if (t >= b)
+                return nullptr;
+            coro_proto* p = m_buf[t & (N - 1)].load(std::memory_order_relaxed);
+            if (!m_top.compare_exchange_strong(t, t + 1,
+                                               std::memory_order_seq_cst,
+                                               std::memory_order_relaxed))
+                return nullptr;
+            return p;
+        }
+
+        bool empty() const noexcept {
+            return m_bottom.load(std::memory_order_relaxed) <=
+                   m_top.load(std::memory_order_relaxed);
+        }
+
+    private:
+        alignas(cache_line) std::atomic<std::int64_t> m_top{0};
+        alignas(cache_line) std::atomic<std::int64_t> m_bottom{0};
+        alignas(cache_line) std::atomic<coro_proto*> m_buf[N];
+    };
+
+    // Bounded MPMC queue, as described in "Bounded MPMC queue" (Vyukov).
+    // Each cell has a sequence number that tells whose turn it is, so the
+    // producers and the consumers only contend on their own index.
+    template<std::size_t N>
+    struct mpmc_queue {
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+        mpmc_queue() noexcept {
+            for (std::size_t i = 0; i != N; ++i)
+                m_cells[i].m_seq.store(i, std::memory_order_relaxed);
+        }
+
+        // Any thread, returns false if full.
+        bool push(coro_proto* p) noexcept {
+            std::size_t pos = m_tail.load(std::memory_order_relaxed);
+            for (;;) {
+                cell& c = m_cells[pos & (N - 1)];
+                const std::size_t seq = c.m_seq.load(std::memory_order_acquire);
+                const auto diff = std::intptr_t(seq) - std::intptr_t(pos);
+                if (diff == 0) {
+                    if (m_tail.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        c.m_data = p;
+                        c.m_seq.store(pos + 1, std::memory_order_release);
+                        return true;
+                    }
+                } else if (diff < 0) {
+                    return false;
+                } else {
+                    pos = m_tail.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+        // Any thread, returns null if empty.
+        coro_proto* pop() noexcept {
+            std::size_t pos = m_head.load(std::memory_order_relaxed);
+            for (;;) {
+                cell& c = m_cells[pos & (N - 1)];
+                const std::size_t seq = c.m_seq.load(std::memory_order_acquire);
+                const auto diff = std::intptr_t(seq) - std::intptr_t(pos + 1);
+                if (diff == 0) {
+                    if (m_head.compare_exchange_weak(
+                            pos, pos + 1, std::memory_order_relaxed)) {
+                        coro_proto* p = c.m_data;
+                        c.m_seq.store(pos + N, std::memory_order_release);
+                        return p;
+                    }
+                } else if (diff < 0) {
+                    return nullptr;
+                } else {
+                    pos = m_head.load(std::memory_order_relaxed);
+                }
+            }
+        }
+
+    private:
+        struct cell {
+            std::atomic<std::size_t> m_seq;
+            coro_proto* m_data;
+        };
+
+        alignas(cache_line) std::atomic<std::size_t> m_head{0};
+        alignas(cache_line) std::atomic<std::size_t> m_tail{0};
+        alignas(cache_line) cell m_cells[N];
+    };
+
+    // FIFO ring with a fixed capacity, owner only.
+    template<std::size_t N>
+    struct local_ring {
+        static_assert((N & (N - 1)) == 0, "N must be a power of 2");
+
+        // Returns false if full.
+        bool push(coro_proto* p) noexcept {
+            if (m_tail - m_head == N)
+                return false;
+            m_buf[m_tail++ & (N - 1)] = p;
+            return true;
+        }
+
+        // Must not be empty.
+        coro_proto* pop() noexcept { return m_buf[m_head++ & (N - 1)]; }
+
+        std::size_t size() const noexcept { return m_tail - m_head; }
+
+    private:
+        std::size_t m_head = 0;
+        std::size_t m_tail = 0;
+        coro_proto* m_buf[N];
+    };
+} // namespace coz::detail
+
+namespace coz {
+    // Work-stealing executor. Each worker has a Chase-Lev deque and a LIFO
+    // slot, the coroutines scheduled from outside go to a shared MPMC queue.
+    struct thread_pool {
+        explicit thread_pool(
+            unsigned threads = std::thread::hardware_concurrency())
+            : m_workers(threads ? threads : 1) {
+            m_threads.reserve(m_workers.size());
+            for (std::size_t i = 0; i != m_workers.size(); ++i)
+                m_threads.emplace_back([this, i] { run(i); });
+        }
+
+        thread_pool(const thread_pool&) = delete;
+        thread_pool& operator=(const thread_pool&) = delete;
+
+        // The workers run the queued coroutines, and the ones they queue in
+        // turn, until there's no more work, then they are joined.
+        ~thread_pool() {
+            m_stop.store(true, std::memory_order_seq_cst);
+            m_epoch.fetch_add(1, std::memory_order_seq_cst);
+            m_epoch.notify_all();
+            for (auto& t : m_threads)
+                t.join();
+        }
+
+        std::size_t size() const noexcept { return m_workers.size(); }
+
+        // Resume the coroutine on the pool. On a worker, it goes to the LIFO
+        // slot, so it runs next on the same thread, e.g. a continuation.
+        void post(coroutine_handle<> coro) {
+            auto p = static_cast<detail::coro_proto*>(coro.address());
+            if (worker* w = current()) {
+                if (detail::coro_proto* prev = std::exchange(w->m_lifo, p))
+                    push_local(*w, prev);
+            } else {
+                push_shared(p);
+            }
+            notify();
+        }
+
+        // Like 'post', but on a worker, it runs after the other queued
+        // coroutines of the worker, e.g. to yield.
+        void defer(coroutine_handle<> coro) {
+            auto p = static_cast<detail::coro_proto*>(coro.address());
+            if (worker* w = current()) {
+                if (!w->m_deferred.push(p)) {
+                    push_shared(p);
+                    notify();
+                }
+            } else {
+                push_shared(p);
+                notify();
+            }
+        }
+
+        // Like 'post' for a batch, e.g. the waiters released together. The
+        // workers are woken once.
+        void post_bulk(const coroutine_handle<>* coros, std::size_t n) {
+            if (n == 0)
+                return;
+            const auto proto = [coros](std::size_t i) {
+                return static_cast<detail::coro_proto*>(coros[i].address());
+            };
+            if (worker* w = current()) {
+                for (std::size_t i = 0; i != n; ++i)
+                    push_local(*w, proto(i));
+            } else {
+                for (std::size_t i = 0; i != n; ++i)
+                    push_shared(proto(i));
+            }
+            notify(n);
+        }
+
+        struct schedule_awaiter {
+            bool await_ready() const noexcept { return false; }
+
+            void await_suspend(coroutine_handle<> coro) {
+                m_pool->defer(coro);
+            }
+
+            void await_resume() const noexcept {}
+
+            thread_pool* m_pool;
+        };
+
+        // Resume on the pool, or yield if already on it.
+        schedule_awaiter schedule() noexcept { return {this}; }
+
+        // Whether the calling thread is a worker of this pool.
+        bool running_in_this_thread() const noexcept {
+            return current() != nullptr;
+        }
+
+    private:
+        // Consecutive runs from the LIFO slot before the deque gets a chance.
+        static constexpr unsigned lifo_budget = 3;
+        // Ticks between the checks of the shared queue.
+        static constexpr unsigned shared_interval = 61;
+        static constexpr std::size_t deque_capacity = 256;
+        static constexpr std::size_t shared_capacity = 4096;
+
+        struct alignas(detail::cache_line) worker {
+            const thread_pool* m_pool = nullptr;
+            detail::coro_proto* m_lifo = nullptr;
+            detail::local_ring<deque_capacity> m_deferred;
+            detail::ws_deque<deque_capacity> m_deque;
+        };
+
+        static inline thread_local worker* t_worker = nullptr;
+
+        worker* current() const noexcept {
+            worker* w = t_worker;
+            return w && w->m_pool == this ? w : nullptr;
+        }
+
+        void push_local(worker& w, detail::coro_proto* p) {
+            if (!w.m_deque.push(p))
+                push_shared(p);
+        }
+
+        // When the shared queue is full, a worker makes room by running the
+        // oldest coroutine itself, the other threads wait for the workers.
+        void push_shared(detail::coro_proto* p) {
+            while (!m_shared.push(p)) {
+                if (current()) {
+                    if (auto q = m_shared.pop())
+                        coroutine_handle<>::from_address(q).resume();
+                } else {
+                    notify();
+                    std::this_thread::yield();
+                }
+            }
+        }
+
+        detail::coro_proto* pop_shared() noexcept { return m_shared.pop(); }
+
+        // Wake a sleeping worker, if any, or all of them for more work.
+        void notify(std::size_t work = 1) noexcept {
+            std::atomic_thread_fence(std::memory_order_seq_cst);
+            if (m_sleepers.load(std::memory_order_relaxed) != 0) {
+                m_epoch.fetch_add(1, std::memory_order_relaxed);
+                if (work > 1) {
+                    m_epoch.notify_all();
+                } else {
+                    m_epoch.notify_one();
+                }
+            }
+        }
+
+        // Try the other workers once, starting from a random one.
+        detail::coro_proto* steal(std::size_t self, std::uint32_t& rng) {
+            const std::size_t n = m_workers.size();
+            if (n == 1)
+                return nullptr;
+            // xorshift32
+            rng ^= rng << 13;
+            rng ^= rng >> 17;
+            rng ^= rng << 5;
+            const std::size_t start = rng % n;
+            for (std::size_t i = 0; i != n; ++i) {
+                const std::size_t victim = (start + i) % n;
+                if (victim == self)
+                    continue;
+                if (auto p = m_workers[victim].m_deque.steal())
+                    return p;
+            }
+            return nullptr;
+        }
+
+        detail::coro_proto* find_work(worker& w, std::size_t self,
+                                      std::uint32_t& rng, unsigned tick,
+                                      unsigned& lifo_runs) {
+            if (tick % shared_interval == 0) {
+                if (auto p = pop_shared())
+                    return p;
+            }
+            if (w.m_lifo) {
+                if (lifo_runs++ < lifo_budget)
+                    return std::exchange(w.m_lifo, nullptr);
+                push_local(w, std::exchange(w.m_lifo, nullptr));
+            }
+            lifo_runs = 0;
+            if (auto p = w.m_deque.pop())
+                return p;
+            if (auto p = pop_shared())
+                return p;
+            // Only the ones deferred so far, as they may defer more.
+            if (std::size_t n = w.m_deferred.size()) {
+                do {
+                    push_local(w, w.m_deferred.pop());
+                } while (--n);
+                notify();
+                return w.m_deque.pop();
+            }
+            return steal(self, rng);
+        }
+
+        void run(std::size_t self) {
+            worker& w = m_workers[self];
+            w.m_pool = this;
+            t_worker = &w;
+            std::uint32_t rng = std::uint32_t(self) * 2654435761u + 1;
+            unsigned lifo_runs = 0;
+            for (unsigned tick = 1;; ++tick) {
+                detail::coro_proto* p =
+                    find_work(w, self, rng, tick, lifo_runs);
+                if (!p) {
+                    // Stopped and out of work. The others drain their own.
+                    if (m_stop.load(std::memory_order_acquire))
+                        break;
+                    // Announce the sleep before the last check, so that a
+                    // concurrent 'notify' either sees it or we see the work.
+                    const unsigned epoch =
+                        m_epoch.load(std::memory_order_relaxed);
+                    m_sleepers.fetch_add(1, std::memory_order_relaxed);
+                    std::atomic_thread_fence(std::memory_order_seq_cst);
+                    if (!m_stop.load(std::memory_order_relaxed)) {
+                        p = pop_shared();
+                        if (!p)
+                            p = steal(self, rng);
+                        if (!p)
+                            m_epoch.wait(epoch, std::memory_order_relaxed);
+                    }
+                    m_sleepers.fetch_sub(1, std::memory_order_relaxed);
+                    if (!p)
+                        continue;
+                }
+                coroutine_handle<>::from_address(p).resume();
+            }
+            t_worker = nullptr;
+        }
+
+        std::vector<worker> m_workers;
+        std::vector<std::thread> m_threads;
+        detail::mpmc_queue<shared_capacity> m_shared;
+        std::atomic<unsigned> m_epoch{0};
+        std::atomic<unsigned> m_sleepers{0};
+        std::atomic<bool> m_stop{false};
+    };
+} // namespace coz
+
+#endif
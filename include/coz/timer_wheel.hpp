@@ -0,0 +1,373 @@
+/*//////////////////////////////////////////////////////////////////////////////
+    Copyright (c) 2024 Jamboree
+
+    Distributed under the Boost Software License, Version 1.0. (See accompanying
+    file LICENSE_1_0.txt or copy at http://www.boost.org/LICENSE_1_0.txt)
+//////////////////////////////////////////////////////////////////////////////*/
+#ifndef COZ_TIMER_WHEEL_HPP
+#define COZ_TIMER_WHEEL_HPP
+
+#include <bit>
+#include <chrono>
+#include <cstdint>
+#include <cstddef>
+#include <cassert>
+#include <optional>
+#include <coz/coroutine.hpp>
+
+namespace coz::detail {
+    // A pending timer, which lives in its awaiter. The lists are doubly
+    // linked via the address of the previous link, for O(1) removal.
+    struct timer_node {
+        coroutine_handle<> m_coro;
+        timer_node* m_next = nullptr;
+        timer_node** m_pprev = nullptr;
+        std::uint64_t m_tick = 0;
+        // The insertion order, which orders the timers of the same tick.
+        std::uint64_t m_seq = 0;
+        // The level of the slot, or 'levels' if it has expired.
+        std::uint8_t m_level = 0;
+        std::uint8_t m_slot = 0;
+    };
+} // namespace coz::detail
+
+namespace coz {
+    // Hierarchical timing wheel, as described in "Hashed and Hierarchical
+    // Timing Wheels" (Varghese and Lauck, 1987). Inserting and cancelling a
+    // timer are O(1), and the timers are embedded in the awaiters, so it
+    // never allocates. The timers expire in the order of their ticks, and
+    // those of the same tick in the order they were inserted. Not
+    // thread-safe.
+    struct timer_wheel {
+        using clock = std::chrono::steady_clock;
+
+        explicit timer_wheel(
+            std::chrono::nanoseconds resolution = std::chrono::milliseconds(1))
+            : m_resolution(resolution), m_origin(clock::now()) {
+            assert(resolution.count() > 0);
+        }
+
+        timer_wheel(const timer_wheel&) = delete;
+        timer_wheel& operator=(const timer_wheel&) = delete;
+
+        // The coroutines waiting on it must have been destroyed.
+        ~timer_wheel() { assert(m_size == 0); }
+
+        struct [[nodiscard]] sleep_awaiter : private detail::timer_node {
+            bool await_ready() const noexcept { return m_ready; }
+
+            void await_suspend(coroutine_handle<> coro) noexcept {
+                m_coro = coro;
+                m_wheel->insert(this);
+            }
+
+            void await_resume() const noexcept {}
+
+            void await_cancel() noexcept { m_wheel->cancel(this); }
+
+        private:
+            friend timer_wheel;
+
+            sleep_awaiter(timer_wheel* wheel, std::uint64_t tick,
+                          bool ready) noexcept
+                : m_wheel(wheel), m_ready(ready) {
+                m_tick = tick;
+            }
+
+            timer_wheel* m_wheel;
+            bool m_ready;
+        };
+
+        // Resumed by 'expire' at or after the deadline, rounded up to the
+        // resolution.
+        sleep_awaiter sleep_until(clock::time_point deadline) noexcept {
+            return {this, tick_of(deadline), deadline <= clock::now()};
+        }
+
+        template<class Rep, class Period>
+        sleep_awaiter
+        sleep_for(std::chrono::duration<Rep, Period> duration) noexcept {
+            const auto d = std::chrono::ceil<clock::duration>(duration);
+            return {this, tick_of(clock::now() + d), d.count() <= 0};
+        }
+
+        // Resume the coroutines whose timer has expired, returns the number
+        // of resumptions.
+        std::size_t expire(clock::time_point now = clock::now()) {
+            advance(tick_of_past(now));
+            std::size_t n = 0;
+            while (detail::timer_node* node = m_expired) {
+                unlink(node);
+                node->m_coro.resume();
+                ++n;
+            }
+            return n;
+        }
+
+        // When the next timer may expire, or when the wheel has to cascade
+        // the timers to a lower level, so it's a lower bound.
+        std::optional<clock::time_point> next_expiry() const noexcept {
+            if (m_expired)
+                return m_origin;
+            if (m_size == 0)
+                return std::nullopt;
+            return m_origin + next_tick() * m_resolution;
+        }
+
+        bool empty() const noexcept { return m_size == 0; }
+
+        // The number of pending timers.
+        std::size_t size() const noexcept { return m_size; }
+
+        // Run the context and the timers until neither has work. 'Context'
+        // has `bool run_one()` and `bool run_one_for(nanoseconds)`, which
+        // waits at most the timeout even if idle, like 'io_uring_context'
+        // and 'epoll_context'.
+        template<class Context>
+        std::size_t run(Context& ctx) {
+            std::size_t n = 0;
+            for (;;) {
+                n += expire();
+                bool resumed;
+                if (const auto next = next_expiry()) {
+                    const auto timeout =
+                        std::chrono::ceil<std::chrono::nanoseconds>(
+                            *next - clock::now());
+                    if (timeout.count() <= 0)
+                        continue;
+                    resumed = ctx.run_one_for(timeout);
+                } else {
+                    resumed = ctx.run_one();
+                }
+                if (resumed) {
+                    ++n;
+                } else if (empty()) {
+                    return n;
+                }
+            }
+        }
+
+    private:
+        static constexpr unsigned levels = 4;
+        static constexpr unsigned slot_bits = 6;
+        static constexpr unsigned slots = 1u << slot_bits;
+        static constexpr std::uint64_t slot_mask = slots - 1;
+        // The farthest tick that fits, the farther ones are cascaded from
+        // the top level repeatedly.
+        static constexpr std::uint64_t max_delta =
+            (std::uint64_t(1) << (slot_bits * levels)) - 1;
+
+        // The first tick at or after the time point.
+        std::uint64_t tick_of(clock::time_point t) const noexcept {
+            if (t <= m_origin)
+                return 0;
+            const auto d =
+                std::chrono::ceil<std::chrono::nanoseconds>(t - m_origin) +
+                m_resolution - std::chrono::nanoseconds(1);
+            return std::uint64_t(d / m_resolution);
+        }
+
+        // The last tick at or before the time point.
+        std::uint64_t tick_of_past(clock::time_point t) const noexcept {
+            if (t <= m_origin)
+                return 0;
+            return std::uint64_t((t - m_origin) / m_resolution);
+        }
+
+        static void push_front(detail::timer_node*& head,
+                               detail::timer_node* node) noexcept {
+            node->m_next = head;
+            if (head)
+                head->m_pprev = &node->m_next;
+            node->m_pprev = &head;
+            head = node;
+        }
+
+        // Append the singly linked list to the expired ones.
+        void push_expired(detail::timer_node* list) noexcept {
+            for (; list; list = list->m_next) {
+                list->m_level = levels;
+                list->m_pprev = m_expired_tail;
+                *m_expired_tail = list;
+                m_expired_tail = &list->m_next;
+            }
+        }
+
+        // Bottom-up merge sort of the singly linked list by 'm_seq', which
+        // doesn't allocate.
+        static detail::timer_node*
+        sort_by_seq(detail::timer_node* list) noexcept {
+            for (std::size_t width = 1;; width *= 2) {
+                detail::timer_node* head = nullptr;
+                detail::timer_node** tail = &head;
+                std::size_t merges = 0;
+                while (list) {
+                    ++merges;
+                    detail::timer_node* a = list;
+                    detail::timer_node* b = list;
+                    std::size_t na = 0;
+                    for (; b && na != width; ++na)
+                        b = b->m_next;
+                    std::size_t nb = width;
+                    while (na || (nb && b)) {
+                        detail::timer_node* e;
+                        if (na && (!nb || !b || a->m_seq <= b->m_seq)) {
+                            e = a;
+                            a = a->m_next;
+                            --na;
+                        } else {
+                            e = b;
+                            b = b->m_next;
+                            --nb;
+                        }
+                        *tail = e;
+                        tail = &e->m_next;
+                    }
+                    list = b;
+                }
+                *tail = nullptr;
+                if (merges <= 1)
+                    return head;
+                list = head;
+            }
+        }
+
+        void unlink(detail::timer_node* node) noexcept {
+            if (node->m_level == levels && !node->m_next)
+                m_expired_tail = node->m_pprev;
+            *node->m_pprev = node->m_next;
+            if (node->m_next)
+                node->m_next->m_pprev = node->m_pprev;
+            node->m_next = nullptr;
+            node->m_pprev = nullptr;
+            if (node->m_level != levels) {
+                if (!m_slots[node->m_level][node->m_slot])
+                    m_occupied[node->m_level] &=
+                        ~(std::uint64_t(1) << node->m_slot);
+                --m_size;
+            }
+        }
+
+        void insert(detail::timer_node* node) noexcept {
+            node->m_seq = m_seq++;
+            if (!place(node)) {
+                node->m_next = nullptr;
+                push_expired(node);
+            }
+        }
+
+        // Put the node into the slot of the level that covers the distance,
+        // returns false if it's due instead.
+        bool place(detail::timer_node* node) noexcept {
+            const std::uint64_t tick = node->m_tick;
+            if (tick <= m_now)
+                return false;
+            std::uint64_t delta = tick - m_now;
+            std::uint64_t at = tick;
+            if (delta > max_delta) {
+                delta = max_delta;
+                at = m_now + max_delta;
+            }
+            unsigned level = 0;
+            while (delta >> (slot_bits * (level + 1)))
+                ++level;
+            const auto slot =
+                unsigned((at >> (slot_bits * level)) & slot_mask);
+            node->m_level = std::uint8_t(level);
+            node->m_slot = std::uint8_t(slot);
+            push_front(m_slots[level][slot], node);
+            m_occupied[level] |= std::uint64_t(1) << slot;
+            ++m_size;
+            return true;
+        }
+
+        void cancel(detail::timer_node* node) noexcept { unlink(node); }
+
+        // The first tick after 'm_now' at which a slot is due, either to
+        // expire (level 0) or to cascade.
+        std::uint64_t next_tick() const noexcept {
+            std::uint64_t best = ~std::uint64_t(0);
+            for (unsigned level = 0; level != levels; ++level) {
+                const std::uint64_t bits = m_occupied[level];
+                if (!bits)
+                    continue;
+                const unsigned shift = slot_bits * level;
+                const std::uint64_t block = m_now >> shift;
+                // The distance from the current slot to the next occupied
+                // one, in 1..slots.
+                const unsigned cur = unsigned(block & slot_mask);
+                const std::uint64_t rotated =
+                    std::rotr(bits, int((cur + 1) & slot_mask));
+                const unsigned k = unsigned(std::countr_zero(rotated)) + 1;
+                const std::uint64_t tick = (block + k) << shift;
+                if (tick < best)
+                    best = tick;
+            }
+            return best;
+        }
+
+        // Move the time forward, cascading the timers down the levels, and
+        // collect the expired ones. All the timers due at a tick are sorted
+        // by insertion before they're appended, because the ones that were
+        // cascaded may have been inserted before the ones in the slot.
+        void advance(std::uint64_t target) noexcept {
+            while (m_now < target) {
+                if (m_size == 0) {
+                    m_now = target;
+                    return;
+                }
+                const std::uint64_t t = next_tick();
+                if (t > target) {
+                    m_now = target;
+                    return;
+                }
+                m_now = t;
+                detail::timer_node* due = nullptr;
+                for (unsigned level = levels - 1; level != 0; --level) {
+                    const unsigned shift = slot_bits * level;
+                    if (t & ((std::uint64_t(1) << shift) - 1))
+                        continue;
+                    const auto slot = unsigned((t >> shift) & slot_mask);
+                    detail::timer_node* node = m_slots[level][slot];
+                    m_slots[level][slot] = nullptr;
+                    m_occupied[level] &= ~(std::uint64_t(1) << slot);
+                    while (node) {
+                        detail::timer_node* next = node->m_next;
+                        --m_size;
+                        if (!place(node)) {
+                            node->m_next = due;
+                            due = node;
+                        }
+                        node = next;
+                    }
+                }
+                const auto slot = unsigned(t & slot_mask);
+                detail::timer_node* node = m_slots[0][slot];
+                m_slots[0][slot] = nullptr;
+                m_occupied[0] &= ~(std::uint64_t(1) << slot);
+                while (node) {
+                    detail::timer_node* next = node->m_next;
+                    --m_size;
+                    node->m_next = due;
+                    due = node;
+                    node = next;
+                }
+                push_expired(sort_by_seq(due));
+            }
+        }
+
+        std::chrono::nanoseconds m_resolution;
+        clock::time_point m_origin;
+        // The last tick processed.
+        std::uint64_t m_now = 0;
+        std::size_t m_size = 0;
+        std::uint64_t m_occupied[levels] = {};
+        detail::timer_node* m_slots[levels][slots] = {};
+        // The expired timers in FIFO order.
+        detail::timer_node* m_expired = nullptr;
+        detail::timer_node** m_expired_tail = &m_expired;
+        std::uint64_t m_seq = 0;
+    };
+} // namespace coz
+
+#endif